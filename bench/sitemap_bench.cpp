@@ -0,0 +1,533 @@
+// Benchmarks of the crawler parts, each one compared with the way it was
+// done before. Run with the names of the benchmarks or without arguments
+// for all of them. Other arguments are html pages for the tags benchmark,
+// the test corpus is used without them.
+// Usage: sitemap_bench [memory] [writers] [tags] [xml_tag] [page.html ...]
+
+#include <cstdlib>
+#include <new>
+#include "sitemap.h"
+
+// Heap bytes in use, counted by the operators below.
+static std::atomic<size_t> heap_bytes{0};
+
+// The size is kept in front of the block, 16 bytes keep the alignment.
+void* operator new(std::size_t size) {
+	auto p = static_cast<size_t*>(std::malloc(size + 16));
+	if(!p) {
+		throw std::bad_alloc();
+	}
+	*p = size;
+	heap_bytes += size;
+	return reinterpret_cast<char*>(p) + 16;
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	try {
+		return operator new(size);
+	} catch(...) {
+		return nullptr;
+	}
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+	if(!p) {
+		return;
+	}
+	auto head = reinterpret_cast<size_t*>(static_cast<char*>(p) - 16);
+	heap_bytes -= *head;
+	std::free(head);
+}
+
+void operator delete[](void* p) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	operator delete(p);
+}
+
+class Bench {
+public:
+	static void memory();
+	static void writers();
+	static void tags();
+	static void xml_tag();
+	static std::vector<std::string> pages;
+};
+
+std::vector<std::string> Bench::pages;
+
+// Urls of a site with a few sections, about as long as real ones.
+static std::vector<std::string> make_urls(size_t n) {
+	const char* sections[] = {"about", "blog", "catalog", "contacts", "docs", "news", "shop", "support"};
+	std::vector<std::string> ret;
+	ret.reserve(n);
+	for(size_t i = 0; i < n; i++) {
+		ret.push_back("https://www.sitename.xx/" + std::string(sections[i % 8]) + "/item-" + std::to_string(i) + ".html?page=" + std::to_string(i % 7));
+	}
+	return ret;
+}
+
+static void report(const std::string& name, const std::string& what, double seconds, size_t n) {
+	std::cout << name << ": " << what << " " << std::fixed << std::setprecision(3) << seconds * 1e6 / n << " us per url" << std::endl;
+}
+
+// Url record as it was before the arena store, and the map from the
+// normalized url to the record index that went with it.
+struct Old_url {
+	std::string found;
+	std::string resolved;
+	std::string normalize;
+	std::string charset;
+	std::string path;
+	std::string host;
+	std::string base_href;
+	bool is_html = false;
+	int id = 0;
+	int parent = 0;
+	double time = 0;
+	int try_cnt = 0;
+	bool ssl = false;
+	size_t redirect_cnt = 0;
+	url_handle_t handle = url_handle_t::query;
+	std::string error;
+	int cnt = 1;
+};
+
+// Heap bytes per url of the old records against Url_store, String_arena,
+// the string tables and Seen_set, filled the way set_url does.
+void Bench::memory() {
+	const size_t n = 500000;
+	auto urls = make_urls(n);
+	const std::string host = "www.sitename.xx";
+	const size_t path_pos = std::string("https://").size() + host.size();
+	size_t before = heap_bytes;
+	{
+		std::vector<std::unique_ptr<Old_url>> url_all;
+		std::unordered_map<std::string, size_t> url_unique;
+		for(size_t i = 0; i < n; i++) {
+			std::unique_ptr<Old_url> url(new Old_url);
+			url->found = urls[i].substr(path_pos);
+			url->resolved = urls[i];
+			url->normalize = urls[i];
+			url->charset = "utf-8";
+			url->path = urls[i].substr(path_pos);
+			url->host = host;
+			url->id = static_cast<int>(i + 1);
+			url_unique.emplace(url->normalize, i);
+			url_all.push_back(std::move(url));
+		}
+		std::cout << "memory: old records " << (heap_bytes - before) / n << " bytes per url" << std::endl;
+	}
+	before = heap_bytes;
+	{
+		Url_store url_all;
+		String_arena url_strings;
+		String_table hosts;
+		String_table charsets;
+		Seen_set url_unique;
+		url_unique.init("", 0, 0);
+		for(size_t i = 0; i < n; i++) {
+			auto rec = url_all.add();
+			rec->id = static_cast<int>(i + 1);
+			rec->resolved = url_strings.add(urls[i]);
+			rec->found = url_strings.add(urls[i].substr(path_pos));
+			rec->path_pos = static_cast<uint32_t>(path_pos);
+			rec->path_len = static_cast<uint32_t>(urls[i].size() - path_pos);
+			rec->host = hosts.add(host);
+			rec->charset = charsets.add("utf-8");
+			url_unique.add(utils::hash128(urls[i].data(), urls[i].size()), static_cast<uint32_t>(i));
+			url_all.publish();
+		}
+		std::cout << "memory: arena records with found " << (heap_bytes - before) / n << " bytes per url" << std::endl;
+		// finished records without a checkpoint or info log
+		for(size_t i = 0; i < n; i++) {
+			url_strings.release(url_all[i]->resolved);
+			url_strings.release(url_all[i]->found);
+		}
+		std::cout << "memory: arena records when finished " << (heap_bytes - before) / n << " bytes per url" << std::endl;
+	}
+}
+
+// Escaping and element writing of XML_writer before the single pass
+// encoder: five regexes per string and a tab string per element.
+class Old_xml_writer {
+public:
+	explicit Old_xml_writer(std::ostream& stream) : output(stream) {}
+	static std::string escape_str(std::string text) {
+		text = std::regex_replace(text, std::regex("&"), "&amp;");
+		text = std::regex_replace(text, std::regex("\'"), "&apos;");
+		text = std::regex_replace(text, std::regex("<"), "&lt;");
+		text = std::regex_replace(text, std::regex(">"), "&gt;");
+		text = std::regex_replace(text, std::regex("\""), "&quot;");
+		return text;
+	}
+	void write_start_el(const std::string& name) {
+		close_tag_if_open();
+		output << "\n" << std::string(indent_level++, '\t') << "<" << name;
+		open_tags.push(name);
+		cur_tag_unclosed = true;
+		last_operation_was_start_el = true;
+	}
+	void write_end_el() {
+		close_tag_if_open();
+		indent_level--;
+		if(!last_operation_was_start_el) {
+			output << "\n" << std::string(indent_level, '\t');
+		}
+		output << "</" << open_tags.top() << ">";
+		open_tags.pop();
+		last_operation_was_start_el = false;
+	}
+	void write_str(const std::string& text) {
+		close_tag_if_open();
+		output << escape_str(text);
+	}
+private:
+	void close_tag_if_open() {
+		if(cur_tag_unclosed) {
+			output << ">";
+			cur_tag_unclosed = false;
+		}
+	}
+	std::stack<std::string> open_tags;
+	std::ostream& output;
+	bool cur_tag_unclosed = false;
+	bool last_operation_was_start_el = false;
+	int indent_level = 0;
+};
+
+// CSV_Writer::add before the rewrite: a copy per field, quotes inserted
+// one by one and std::endl after each row.
+static void old_csv_row(std::ostream& output, const std::vector<std::string>& row, const std::string& separator) {
+	for(size_t i = 0; i < row.size(); i++) {
+		std::string str = row[i];
+		size_t position = str.find("\"", 0);
+		bool found_quotation = position != std::string::npos;
+		while(position != std::string::npos) {
+			str.insert(position, "\"");
+			position = str.find("\"", position + 2);
+		}
+		if(found_quotation || str.find(separator) != std::string::npos) {
+			str = "\"" + str + "\"";
+		}
+		if(i) {
+			output << separator;
+		}
+		output << str;
+	}
+	output << std::endl;
+}
+
+// A 50k url sitemap and a 1M row csv log, old writers against
+// Sitemap_sink and CSV_Log. Files are written to the current directory
+// and removed afterwards.
+void Bench::writers() {
+	const size_t url_cnt = 50000;
+	const size_t row_cnt = 1000000;
+	main_obj.sitemap_dir = ".";
+	main_obj.xml_name = "bench_sitemap";
+	main_obj.xml_index_name.clear();
+	main_obj.xml_gzip = false;
+	main_obj.xml_filemb_lim = 50;
+	main_obj.xml_entry_lim = 50000;
+	main_obj.param_xml_tag.clear();
+	main_obj.xml_tag_regex.clear();
+	main_obj.log_dir = ".";
+	main_obj.rewrite_log = true;
+	auto urls = make_urls(url_cnt);
+	Timer tmr;
+	{
+		std::ofstream file("bench_sitemap_old.xml", std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+		Old_xml_writer writer(file);
+		file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
+		writer.write_start_el("urlset");
+		file << " xmlns=\"http://www.sitemaps.org/schemas/sitemap/0.9\"";
+		for(const auto& url : urls) {
+			writer.write_start_el("url");
+			writer.write_start_el("loc");
+			writer.write_str(url);
+			writer.write_end_el();
+			writer.write_end_el();
+		}
+		writer.write_end_el();
+	}
+	report("writers", "old sitemap", tmr.seconds(), url_cnt);
+	std::deque<Url_struct> recs(url_cnt);
+	std::vector<const Url_struct*> batch;
+	for(size_t i = 0; i < url_cnt; i++) {
+		recs[i].resolved.data = urls[i].data();
+		recs[i].resolved.size = static_cast<uint32_t>(urls[i].size());
+		batch.push_back(&recs[i]);
+	}
+	tmr.reset();
+	{
+		Sitemap_sink sink;
+		sink.open();
+		for(const auto& rec : recs) {
+			sink.add(&rec);
+		}
+		sink.close();
+	}
+	report("writers", "Sitemap_sink, url by url", tmr.seconds(), url_cnt);
+	tmr.reset();
+	{
+		Sitemap_sink sink;
+		sink.open();
+		sink.add(batch);
+		sink.close();
+	}
+	report("writers", "Sitemap_sink, whole list", tmr.seconds(), url_cnt);
+	std::vector<std::vector<std::string>> rows;
+	for(size_t i = 0; i < 1000; i++) {
+		rows.push_back({std::to_string(i + 1), "item-" + std::to_string(i) + ".html", urls[i], std::to_string(i / 2), "0.125000", "1", "utf-8", i % 10 ? "" : "Http code: 404, \"Not Found\""});
+	}
+	const std::vector<Log::Field> fields{Log::id, Log::found, Log::url, Log::parent, Log::time, Log::is_html, Log::charset, Log::msg};
+	tmr.reset();
+	{
+		std::ofstream file("bench_log_old.csv", std::ofstream::out | std::ofstream::trunc);
+		for(size_t i = 0; i < row_cnt; i++) {
+			old_csv_row(file, rows[i % rows.size()], main_obj.csv_separator);
+		}
+	}
+	std::cout << "writers: old csv log " << tmr.seconds() * 1e9 / row_cnt << " ns per row" << std::endl;
+	tmr.reset();
+	{
+		CSV_Log log("bench_log", fields);
+		for(size_t i = 0; i < row_cnt; i++) {
+			log.write(rows[i % rows.size()]);
+		}
+	}
+	std::cout << "writers: CSV_Log " << tmr.seconds() * 1e9 / row_cnt << " ns per row" << std::endl;
+	std::remove("bench_sitemap_old.xml");
+	std::remove("bench_sitemap1.xml");
+	std::remove("bench_log_old.csv");
+	std::remove("bench_log.csv");
+}
+
+// Tag lookup of the parser callback before Tag_table: std::find over
+// Tags_main, then the first entry of Tags_other with the same name.
+// Attribute handlers need a crawling Thread, their values are counted.
+static size_t old_dispatch(const std::string& tag_name, const Tag_attrs& attrs) {
+	if(std::find(Tags_main.begin(), Tags_main.end(), tag_name) != Tags_main.end()) {
+		return !attrs.get("href").empty();
+	}
+	size_t links = 0;
+	for(auto& tag : Tags_other) {
+		if(tag_name == tag.name) {
+			for(auto& attr : tag.attr) {
+				links += !attrs.get(attr.name).empty();
+			}
+			return links;
+		}
+	}
+	return 0;
+}
+
+static size_t new_dispatch(const std::string& tag_name, const Tag_attrs& attrs) {
+	auto entry = tag_table.find(tag_name);
+	if(!entry) {
+		return 0;
+	}
+	if(entry->main) {
+		return !attrs.get("href").empty();
+	}
+	size_t links = 0;
+	if(entry->other) {
+		for(auto& attr : entry->other->attr) {
+			links += !attrs.get(attr.name).empty();
+		}
+	}
+	return links;
+}
+
+// Parse throughput of the link scanner over saved pages, repeated to about
+// 64 MB: Html_stream and Scan_attrs alone, then with each tag lookup and
+// its attributes. The lookups alone are timed over the tag names found.
+void Bench::tags() {
+	std::vector<std::string> names(pages);
+	if(names.empty()) {
+		boost::split(names, BENCH_CORPUS, boost::is_any_of("|"));
+	}
+	std::string corpus;
+	for(const auto& name : names) {
+		std::ifstream file(name, std::ifstream::binary);
+		if(!file.is_open()) {
+			throw std::runtime_error("Can not open " + name);
+		}
+		corpus.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	if(corpus.empty()) {
+		throw std::runtime_error("No pages to parse");
+	}
+	const size_t total = 64 << 20;
+	const size_t chunk = 16384;
+	std::vector<std::string> tag_names;
+	size_t links = 0;
+	auto run = [&](size_t (*dispatch)(const std::string&, const Tag_attrs&)) {
+		Html_stream stream;
+		Scan_attrs attrs;
+		Html_stream::Tag_callback on_tag = [&](const char* data, size_t size) {
+			attrs.parse(data, size);
+			if(dispatch) {
+				links += dispatch(attrs.tag_name(), attrs);
+			} else if(tag_names.size() < 1000000) {
+				tag_names.push_back(attrs.tag_name());
+			}
+		};
+		Timer tmr;
+		for(size_t done = 0; done < total; done += corpus.size()) {
+			stream.reset();
+			for(size_t i = 0; i < corpus.size(); i += chunk) {
+				stream.feed(corpus.data() + i, std::min(chunk, corpus.size() - i), on_tag);
+			}
+			stream.finish(on_tag);
+		}
+		return tmr.seconds();
+	};
+	double base = run(nullptr);
+	double old_time = run(old_dispatch);
+	double new_time = run(new_dispatch);
+	auto line = [](const std::string& what, double seconds) {
+		std::cout << "tags: " << what << " " << std::fixed << std::setprecision(1) << total / seconds / (1 << 20) << " MB/s" << std::endl;
+	};
+	line("scan only", base);
+	line("scan, std::find and Tags_other", old_time);
+	line("scan, Tag_table", new_time);
+	Timer tmr;
+	for(const auto& name : tag_names) {
+		if(std::find(Tags_main.begin(), Tags_main.end(), name) != Tags_main.end()) {
+			links++;
+			continue;
+		}
+		for(auto& tag : Tags_other) {
+			if(name == tag.name) {
+				links++;
+				break;
+			}
+		}
+	}
+	double seconds = tmr.seconds();
+	std::cout << "tags: lookup, std::find and Tags_other " << std::setprecision(3) << seconds * 1e9 / tag_names.size() << " ns per tag" << std::endl;
+	tmr.reset();
+	for(const auto& name : tag_names) {
+		links += tag_table.find(name) != nullptr;
+	}
+	seconds = tmr.seconds();
+	std::cout << "tags: lookup, Tag_table " << seconds * 1e9 / tag_names.size() << " ns per tag" << std::endl;
+	// keeps the work from being optimized away
+	if(!links) {
+		std::cout << std::endl;
+	}
+}
+
+// xml_tag rules: a regex built for every rule and url, as in the old
+// Main::finished, against the rules compiled at startup.
+void Bench::xml_tag() {
+	const char* rules[][3] = {
+		{"changefreq", "weekly", "default"},
+		{"changefreq", "daily", "^https?://www\\.sitename\\.xx/news/"},
+		{"changefreq", "daily", "^https?://www\\.sitename\\.xx/blog/"},
+		{"changefreq", "monthly", "^https?://www\\.sitename\\.xx/about/"},
+		{"changefreq", "monthly", "^https?://www\\.sitename\\.xx/contacts/"},
+		{"changefreq", "yearly", "/docs/.*\\.html$"},
+		{"priority", "0.3", "default"},
+		{"priority", "0.8", "^https?://www\\.sitename\\.xx/shop/"},
+		{"priority", "0.7", "^https?://www\\.sitename\\.xx/catalog/"},
+		{"priority", "0.5", "^https?://www\\.sitename\\.xx/about/"},
+		{"priority", "0.4", "^https?://www\\.sitename\\.xx/contacts/"},
+		{"priority", "0.6", "page=[0-3]$"}
+	};
+	// the same structures import_param builds
+	main_obj.param_xml_tag.clear();
+	main_obj.xml_tag_regex.clear();
+	std::vector<std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> old_rules;
+	for(const auto& rule : rules) {
+		auto& tag = main_obj.param_xml_tag[rule[0]];
+		if(old_rules.empty() || old_rules.back().first != rule[0]) {
+			old_rules.emplace_back(rule[0], std::vector<std::pair<std::string, std::string>>());
+		}
+		if(std::string(rule[2]) == "default") {
+			tag.def = rule[1];
+			continue;
+		}
+		main_obj.xml_tag_regex.emplace_back(rule[2], std::regex_constants::ECMAScript | std::regex_constants::icase | std::regex_constants::optimize);
+		tag.rules.emplace_back(rule[1], main_obj.xml_tag_regex.size() - 1);
+		old_rules.back().second.emplace_back(rule[1], rule[2]);
+	}
+	auto urls = make_urls(20000);
+	size_t matches = 0;
+	Timer tmr;
+	for(const auto& url : urls) {
+		for(const auto& tag : old_rules) {
+			for(const auto& rule : tag.second) {
+				std::regex reg(rule.second, std::regex_constants::ECMAScript | std::regex_constants::icase);
+				matches += std::regex_search(url, reg);
+			}
+		}
+	}
+	report("xml_tag", "regex per rule and url", tmr.seconds(), urls.size());
+	urls = make_urls(200000);
+	std::deque<Url_struct> recs(urls.size());
+	for(size_t i = 0; i < urls.size(); i++) {
+		recs[i].resolved.data = urls[i].data();
+		recs[i].resolved.size = static_cast<uint32_t>(urls[i].size());
+	}
+	Sitemap_sink sink;
+	std::string out;
+	tmr.reset();
+	for(const auto& rec : recs) {
+		out.clear();
+		sink.render(&rec, out);
+		matches += out.size();
+	}
+	report("xml_tag", "compiled rules, whole <url> entry", tmr.seconds(), recs.size());
+	// keeps the work from being optimized away
+	if(!matches) {
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::vector<std::pair<std::string, std::function<void()>>> benches{
+		{"memory", Bench::memory},
+		{"writers", Bench::writers},
+		{"tags", Bench::tags},
+		{"xml_tag", Bench::xml_tag}
+	};
+	std::set<std::string> names;
+	for(int i = 1; i < argc; i++) {
+		auto it = std::find_if(benches.begin(), benches.end(), [&](const std::pair<std::string, std::function<void()>>& bench) {
+			return bench.first == argv[i];
+		});
+		if(it != benches.end()) {
+			names.insert(argv[i]);
+		} else {
+			Bench::pages.push_back(argv[i]);
+		}
+	}
+	try {
+		for(const auto& bench : benches) {
+			if(names.empty() || names.count(bench.first)) {
+				bench.second();
+			}
+		}
+	} catch(std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef INFO_DB_H
+#define INFO_DB_H
+
+#include <cstdint>
+#include <cstring>
+
+// Binary table of the crawled urls written by sitemap at the end of a run
+// and read by sitemap_db. Columns follow the head, each one starts at an
+// offset aligned to 8 bytes so the file can be mapped and used in place.
+//
+// Fixed columns hold one value per row. String columns are a heap of
+// concatenated strings plus rows + 1 uint64 offsets into it. charset and
+// msg are indexes into small string tables stored the same way.
+namespace info_db {
+
+const char magic[8] = "SMINFO1";
+
+enum column_t : uint32_t {
+	id,          // int32
+	parent,      // int32
+	time,        // double
+	try_cnt,     // int32
+	cnt,         // int32
+	is_html,     // uint8
+	duplicate,   // int32
+	charset,     // uint32, index into charset_offset
+	msg,         // uint32, index into msg_offset
+	found_offset,
+	found_heap,
+	url_offset,
+	url_heap,
+	charset_offset,
+	charset_heap,
+	msg_offset,
+	msg_heap,
+	column_cnt
+};
+
+struct Column {
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct Head {
+	char magic[8];
+	uint64_t rows;
+	uint64_t charset_cnt;
+	uint64_t msg_cnt;
+	Column columns[column_cnt];
+};
+
+// Column size and bounds checks of a mapped file, false if it is not valid.
+inline bool check(const char* data, uint64_t size) {
+	if(size < sizeof(Head)) {
+		return false;
+	}
+	Head head;
+	std::memcpy(&head, data, sizeof(head));
+	if(std::memcmp(head.magic, magic, sizeof(magic))) {
+		return false;
+	}
+	for(uint32_t i = 0; i < column_cnt; i++) {
+		const Column& c = head.columns[i];
+		if(c.offset % 8 || c.offset > size || c.size > size - c.offset) {
+			return false;
+		}
+	}
+	const uint64_t widths[] = {4, 4, 8, 4, 4, 1, 4, 4, 4};
+	for(uint32_t i = id; i <= msg; i++) {
+		if(head.columns[i].size != head.rows * widths[i]) {
+			return false;
+		}
+	}
+	return head.columns[found_offset].size == (head.rows + 1) * 8 &&
+		head.columns[url_offset].size == (head.rows + 1) * 8 &&
+		head.columns[charset_offset].size == (head.charset_cnt + 1) * 8 &&
+		head.columns[msg_offset].size == (head.msg_cnt + 1) * 8;
+}
+
+}
+
+#endif // INFO_DB_H
@@ -0,0 +1,34 @@
+#include "sitemap.h"
+
+int main(int argc, char *argv[]) {
+	try {
+		if(argc < 2 || argc > 3 || (argc == 3 && std::string(argv[2]) != "--resume")) {
+			throw std::runtime_error("Usage: " + std::string(argv[0]) + " setting.conf [--resume]");
+		}
+		main_obj.resume = argc == 3;
+		Timer tmr;
+		main_obj.import_param(argv[1]);
+		main_obj.start();
+		if(exc_ptr) {
+			std::rethrow_exception(exc_ptr);
+		}
+		main_obj.finished();
+		auto elapsed_str = "Elapsed time: " + tmr.elapsed_str();
+		std::cout << elapsed_str << std::endl;
+		if(main_obj.log_other) {
+			main_obj.log_other.write({elapsed_str});
+		}
+		for(const auto& str : main_obj.summary()) {
+			std::cout << str << std::endl;
+			if(main_obj.log_other) {
+				main_obj.log_other.write({str});
+			}
+		}
+	} catch (const std::exception& e) {
+		std::cout << e.what() << std::endl;
+		if(main_obj.log_other) {
+			main_obj.log_other.write({e.what()});
+		}
+	}
+	return 0;
+}
\ No newline at end of file
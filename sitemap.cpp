@@ -40,6 +40,8 @@ std::vector<Tag> Tags_other{
 	{"*", {{"itemtype"}}}
 };
 
+Tag_table tag_table(Tags_main, Tags_other);
+
 std::string Timer::elapsed_str(int p) const {
 	std::stringstream ret;
 	const auto diff = clock_::now() - beg_;
@@ -74,7 +76,9 @@ void XML_writer::write_end_doc() {
 
 void XML_writer::write_start_el(const std::string& name) {
 	close_tag_if_open();
-	this->output << "\n" << std::string(this->indent_level++, '	') << "<" << name;
+	this->output << '\n';
+	write_indent(this->indent_level++);
+	this->output << '<' << name;
 	this->open_tags.push(name);
 	this->cur_tag_unclosed = true;
 	this->last_operation_was_start_el = true;
@@ -87,7 +91,8 @@ void XML_writer::write_end_el() {
 	close_tag_if_open();
 	this->indent_level--;
 	if(!this->last_operation_was_start_el) {
-		this->output << "\n" << std::string(this->indent_level, '	');
+		this->output << '\n';
+		write_indent(this->indent_level);
 	}
 	this->output << "</" << this->open_tags.top() << ">";
 	this->open_tags.pop();
@@ -105,25 +110,76 @@ void XML_writer::write_attr(const std::string& name, const std::string& value) {
 	if(!this->cur_tag_unclosed) {
 		throw std::runtime_error("Attempt to write attribute while not in open tag.");
 	}
-	this->output << " " << name << "=\"" << escape_str(value) << "\"";
+	this->output << ' ' << name << "=\"";
+	write_escaped(value);
+	this->output << '"';
 }
 
 void XML_writer::write_str(const std::string& text, bool escape) {
 	close_tag_if_open();
-	this->output << (escape ? escape_str(text) : text);
+	if(escape) {
+		write_escaped(text);
+	} else {
+		this->output << text;
+	}
+}
+
+void XML_writer::write_indent(int level) {
+	static const std::string tabs(32, '	');
+	while(level > 0) {
+		int n = std::min(level, static_cast<int>(tabs.size()));
+		this->output.write(tabs.data(), n);
+		level -= n;
+	}
+}
+
+static const char* xml_entity(char c) {
+	switch(c) {
+		case '&': return "&amp;";
+		case '\'': return "&apos;";
+		case '<': return "&lt;";
+		case '>': return "&gt;";
+		default: return "&quot;";
+	}
+}
+
+void XML_writer::write_escaped(const std::string& text) {
+	const char* p = text.data();
+	const char* end = p + text.size();
+	while(p < end) {
+		const char* special = utils::find_xml_special(p, end);
+		this->output.write(p, special - p);
+		if(special == end) {
+			break;
+		}
+		this->output << xml_entity(*special);
+		p = special + 1;
+	}
 }
 
 void XML_writer::flush() {
 	this->output.flush();
 }
 
-std::string XML_writer::escape_str(std::string text) {
-	text = std::regex_replace(text, std::regex("&"), "&amp;");
-	text = std::regex_replace(text, std::regex("\'"), "&apos;");
-	text = std::regex_replace(text, std::regex("<"), "&lt;");
-	text = std::regex_replace(text, std::regex(">"), "&gt;");
-	text = std::regex_replace(text, std::regex("\""), "&quot;");
-	return text;
+std::string XML_writer::escape_str(const std::string& text) {
+	const char* p = text.data();
+	const char* end = p + text.size();
+	const char* special = utils::find_xml_special(p, end);
+	if(special == end) {
+		return text;
+	}
+	std::string ret;
+	ret.reserve(text.size() + 16);
+	while(p < end) {
+		ret.append(p, special);
+		if(special == end) {
+			break;
+		}
+		ret += xml_entity(*special);
+		p = special + 1;
+		special = utils::find_xml_special(p, end);
+	}
+	return ret;
 }
 
 CSV_Writer::CSV_Writer(std::ostream& stream, std::string seperator) : output(stream), seperator(seperator) {}
@@ -136,19 +192,28 @@ CSV_Writer& CSV_Writer::add(char *str){
 	return this->add(std::string(str));
 }
 
-CSV_Writer& CSV_Writer::add(std::string str) {
-	size_t position = str.find("\"",0);
-	bool found_quotation = position != std::string::npos;
-	while(position != std::string::npos) {
-		str.insert(position,"\"");
-		position = str.find("\"",position + 2);
+CSV_Writer& CSV_Writer::add(const std::string& str) {
+	if(!line_empty) {
+		this->output << this->seperator;
+	}
+	line_empty = false;
+	size_t position = str.find('"');
+	if(position == std::string::npos && str.find(this->seperator) == std::string::npos) {
+		this->output << str;
+		return *this;
 	}
-	if(found_quotation) {
-		str = "\"" + str + "\"";
-	} else if(str.find(this->seperator) != std::string::npos) {
-		str = "\"" + str + "\"";
+	// quoted field, quotes are doubled
+	this->output << '"';
+	size_t start = 0;
+	while(position != std::string::npos) {
+		this->output.write(str.data() + start, position + 1 - start);
+		this->output << '"';
+		start = position + 1;
+		position = str.find('"', start);
 	}
-	return this->add<std::string>(str);
+	this->output.write(str.data() + start, str.size() - start);
+	this->output << '"';
+	return *this;
 }
 
 template<typename T>
@@ -168,7 +233,7 @@ CSV_Writer& CSV_Writer::operator<<(const T& t) {
 
 CSV_Writer& CSV_Writer::row() {
 	if(!line_empty) {
-		output << std::endl;
+		output << '\n';
 		line_empty = true;
 	}
 	return *this;
@@ -190,6 +255,8 @@ Log::Log(const std::string& _file_name, const std::string& ext, const std::vecto
 			}
 		} while(utils::file_exists(file_name));
 	}
+	buffer.resize(utils::file_buffer_size);
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
 	file.open(file_name, std::ios::out | std::ios::trunc);
 	if(!file.is_open()) {
 		throw std::runtime_error("Can not open " + file_name);
@@ -216,7 +283,7 @@ void Console_Log::write(const std::vector<std::string>& msg) {
 		}
 		std::cout << fields_all[fields[i]] << ": " << msg[i];
 	}
-	std::cout << std::endl;
+	std::cout << '\n';
 }
 
 CSV_Log::CSV_Log(const std::string& file_name, const std::vector<Field>& fields): Log(file_name, "csv", fields), writer(file, main_obj.csv_separator) {
@@ -274,852 +341,4482 @@ void LogWrap::init(const std::set<std::string>& types, const std::string& file_n
 	enabled = true;
 }
 
-void LogWrap::write(const std::vector<std::string>& msg) const {
+void LogWrap::write(std::vector<std::string> msg) const {
+	if(!main_obj.log_queue.push(this, msg)) {
+		write_now(msg);
+	}
+}
+
+void LogWrap::write_now(const std::vector<std::string>& msg) const {
 	for(const auto& log : logs) {
 		log->write(msg);
 	}
 }
 
-void Main::import_param(const std::string& file) {
-
-	namespace po = boost::program_options;
-
-	std::ifstream infile(file);
-	if(!infile.is_open()) {
-		throw std::runtime_error("Can not open setting file");
+void Log_queue::start(size_t size, overflow_t _overflow) {
+	size_t cap = 2;
+	while(cap < size) {
+		cap <<= 1;
 	}
+	cells.reset(new Cell[cap]);
+	for(size_t i = 0; i < cap; i++) {
+		cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+	mask = cap - 1;
+	overflow = _overflow;
+	running = true;
+	uthread = std::thread(&Log_queue::loop, this);
+}
 
-	po::variables_map options;
-	po::options_description desc;
-
-	desc.add_options()
-		("main.subdomain", po::value<bool>(&param_subdomain))
-		("main.link_check", po::value<bool>(&link_check))
-		("main.thread", po::value<int>(&thread_cnt))
-		("main.url", po::value<std::string>(&param_url))
-		("main.sleep", po::value<int>(&param_sleep))
-		("main.try_limit", po::value<int>(&try_limit))
-		("main.url_limit", po::value<size_t>(&url_limit))
-		("main.redirect_limit", po::value<size_t>(&redirect_limit))
-		("main.cert_verification", po::value<bool>(&cert_verification))
-		("main.ca_cert_file_path", po::value<std::string>(&ca_cert_file_path))
-		("main.ca_cert_dir_path", po::value<std::string>(&ca_cert_dir_path))
-		("main.bind_interface", po::value<std::string>(&param_interface))
-		("filters.filter", po::value<std::vector<std::string>>())
-		("sitemap.enabled", po::value<bool>(&sitemap))
-		("sitemap.dir", po::value<std::string>(&sitemap_dir))
-		("sitemap.file_name", po::value<std::string>(&xml_name))
-		("sitemap.index_file_name", po::value<std::string>(&xml_index_name))
-		("sitemap.filemb_lim", po::value<int>(&xml_filemb_lim))
-		("sitemap.entry_lim", po::value<int>(&xml_entry_lim))
-		("sitemap.xml_tag", po::value<std::vector<std::string>>())
-		("log.type", po::value<std::string>())
-		("log.dir", po::value<std::string>(&log_dir))
-		("log.rewrite", po::value<bool>(&rewrite_log))
-		("log.max_log_cnt", po::value<int>(&max_log_cnt))
-		("log.csv_separator", po::value<std::string>(&csv_separator))
-		("log.log_redirect", po::value<bool>(&param_log_redirect))
-		("log.log_bad_html", po::value<bool>(&param_log_bad_html))
-		("log.log_bad_url", po::value<bool>(&param_log_bad_url))
-		("log.log_error_reply", po::value<bool>(&param_log_error_reply))
-		("log.log_ignored_url", po::value<bool>(&param_log_ignored_url))
-		("log.log_info", po::value<bool>(&param_log_info))
-		("log.log_other", po::value<bool>(&param_log_other))
-		("log.log_skipped_url", po::value<bool>(&param_log_skipped_url))
-	;
-	po::store(po::parse_config_file(infile, desc), options);
-	po::notify(options);
+// Returns false if the message was not queued and must be written by the caller.
+bool Log_queue::push(const LogWrap* log, std::vector<std::string>& msg) {
+	// counted before running is read, so stop either sees the push or the
+	// push sees that the queue is stopping
+	producers.fetch_add(1);
+	bool ret = queue(log, msg);
+	producers.fetch_sub(1, std::memory_order_release);
+	if(!ret && stopped.load()) {
+		std::lock_guard<std::mutex> lk(mutex_stop);
+		log->write_now(msg);
+		return true;
+	}
+	return ret;
+}
 
-	if(param_url.empty()) {
-		throw std::runtime_error("Parameter 'url' is empty");
+bool Log_queue::queue(const LogWrap* log, std::vector<std::string>& msg) {
+	if(!running.load()) {
+		return false;
 	}
-	boost::system::result<boost::urls::url> r = boost::urls::parse_uri_reference(param_url);
-	if(!r) {
-		throw std::runtime_error("Parameter 'url' is not valid");
+	if(try_push(log, msg)) {
+		return true;
 	}
-	uri = r.value();
-
-	if(options.count("filters.filter")) {
-		const auto& filters = options["filters.filter"].as<std::vector<std::string>>();
-		for(const auto& filter : filters) {
-			str_vec v;
-			boost::split(v, filter, boost::is_any_of(" "));
-			if(v.size() != 3) {
-				throw std::runtime_error("Parameter 'filter' (" + filter + ") is not valid");
-			}
-			Filter f;
-			if(v[0] == "regexp") {
-				f.type = Filter::type_regexp;
-				try {
-					f.reg = std::regex(v[2], std::regex_constants::ECMAScript | std::regex_constants::icase);
-				} catch(std::exception& e) {
-					throw std::runtime_error(std::string("Parameter 'filter' (" + filter + ") is not valid: ") + e.what());
-				}
-			} else if(v[0] == "get") {
-				f.type = Filter::type_get;
-				f.val = v[2];
-			} else if(v[0] == "ext") {
-				f.type = Filter::type_ext;
-				f.val = v[2];
-			} else {
-				throw std::runtime_error("Parameter 'filter' (" + filter + ") is not valid");
-			}
-			if(v[1] == "include") {
-				f.dir = Filter::include;
-			} else if(v[1] == "exclude") {
-				f.dir = Filter::exclude;
-			} else if(v[1] == "skip") {
-				f.dir = Filter::skip;
-			} else {
-				throw std::runtime_error("Parameter 'filter' (" + filter + ") is not valid");
-			}
-			param_filter.push_back(std::move(f));
+	if(overflow != block) {
+		if(overflow == count) {
+			dropped++;
 		}
+		return true;
 	}
-
-	if(options.count("sitemap.xml_tag")) {
-		const auto& tags = options["sitemap.xml_tag"].as<std::vector<std::string>>();
-		for(const auto& tag : tags) {
-			str_vec v;
-			boost::split(v, tag, boost::is_any_of(" "));
-			if(v.size() != 3) {
-				throw std::runtime_error("Parameter 'xml_tag' (" + tag + ") is not valid");
-			}
-			param_xml_tag[v[0]];
-			if(v[2] == "default") {
-				param_xml_tag[v[0]].def = v[2];
-			} else {
-				param_xml_tag[v[0]].regexp.emplace_back(v[1], v[2]);
-			}
+	while(!try_push(log, msg)) {
+		if(!running.load()) {
+			return false;
 		}
+		std::this_thread::yield();
 	}
+	return true;
+}
 
-	if(options.count("log.type")) {
-		str_vec vec;
-		boost::split(vec, options["log.type"].as<std::string>(), boost::is_any_of(","));
-		std::set<std::string> param_type_log(vec.begin(), vec.end());
-		type_log = std::move(param_type_log);
-		if(type_log.find("csv") != type_log.end() || type_log.find("xml") != type_log.end()) {
-			if(log_dir.empty()) {
-				throw std::runtime_error("Parameter 'log.dir' is empty");
+bool Log_queue::try_push(const LogWrap* log, std::vector<std::string>& msg) {
+	size_t pos = head.load(std::memory_order_relaxed);
+	Cell* cell;
+	while(true) {
+		cell = &cells[pos & mask];
+		size_t seq = cell->seq.load(std::memory_order_acquire);
+		auto dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+		if(dif == 0) {
+			if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
 			}
+		} else if(dif < 0) {
+			return false;
+		} else {
+			pos = head.load(std::memory_order_relaxed);
 		}
 	}
-	auto it = type_log.find("console");
-	if(it != type_log.end()) {
-		type_log.erase(it);
-		if(param_log_redirect) {
-			log_redirect_console.init({"console"}, "redirect", {Log::Field::url, Log::Field::parent});
-		}
-		if(param_log_error_reply) {
-			log_error_reply_console.init({"console"}, "error_reply", {Log::Field::msg, Log::Field::url, Log::Field::parent});
-		}
-		if(param_log_ignored_url) {
-			log_ignored_url_console.init({"console"}, "ignored_url", {Log::Field::found, Log::Field::parent});
-		}
-		if(param_log_skipped_url) {
-			log_skipped_url_console.init({"console"}, "skipped_url", {Log::Field::url, Log::Field::parent});
+	cell->log = log;
+	cell->msg = std::move(msg);
+	cell->seq.store(pos + 1, std::memory_order_release);
+	// pairs with the fence in loop, either the writer sees the cell or
+	// we see that it sleeps
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(sleeping.load(std::memory_order_relaxed)) {
+		{
+			std::lock_guard<std::mutex> lk(mutex);
 		}
-		if(param_log_bad_html) {
-			log_bad_html_console.init({"console"}, "bad_html", {Log::Field::msg, Log::Field::url});
+		cond.notify_one();
+	}
+	return true;
+}
+
+bool Log_queue::ready() const {
+	return cells[tail & mask].seq.load(std::memory_order_acquire) == tail + 1;
+}
+
+bool Log_queue::pop() {
+	if(!ready()) {
+		return false;
+	}
+	Cell& cell = cells[tail & mask];
+	cell.log->write_now(cell.msg);
+	cell.msg.clear();
+	cell.seq.store(tail + mask + 1, std::memory_order_release);
+	tail++;
+	return true;
+}
+
+void Log_queue::loop() {
+	while(true) {
+		size_t n = 0;
+		while(pop()) {
+			n++;
 		}
-		if(param_log_bad_url) {
-			log_bad_url_console.init({"console"}, "bad_url", {Log::Field::found, Log::Field::parent});
+		if(n) {
+			std::cout.flush();
+			continue;
 		}
-		if(param_log_info) {
-			log_info_console.init({"console"}, "info", {Log::Field::thread, Log::Field::time, Log::Field::url, Log::Field::parent});
+		if(!running.load()) {
+			break;
 		}
+		std::unique_lock<std::mutex> lk(mutex);
+		sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		cond.wait(lk, [this] {
+			return ready() || !running.load();
+		});
+		sleeping.store(false, std::memory_order_relaxed);
 	}
-	if(param_log_redirect) {
-		log_redirect_file.init(type_log, "redirect", {Log::Field::url, Log::Field::id_parent});
-	}
-	if(param_log_error_reply) {
-		log_error_reply_file.init(type_log, "error_reply", {Log::Field::msg, Log::Field::url, Log::Field::id_parent});
-	}
-	if(param_log_ignored_url) {
-		log_ignored_url_file.init(type_log, "ignored_url", {Log::Field::found, Log::Field::id_parent});
-	}
-	if(param_log_skipped_url) {
-		log_skipped_url_file.init(type_log, "skipped_url", {Log::Field::url, Log::Field::id_parent});
+}
+
+// Waits for pushes in progress, so that no claimed cell is left unwritten.
+void Log_queue::stop() {
+	if(!uthread.joinable()) {
+		return;
 	}
-	if(param_log_bad_html) {
-		log_bad_html_file.init(type_log, "bad_html", {Log::Field::msg, Log::Field::id});
+	std::lock_guard<std::mutex> lk(mutex_stop);
+	stopped = true;
+	running = false;
+	{
+		std::lock_guard<std::mutex> lk_wake(mutex);
 	}
-	if(param_log_bad_url) {
-		log_bad_url_file.init(type_log, "bad_url", {Log::Field::found, Log::Field::id_parent});
+	cond.notify_one();
+	while(producers.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
 	}
-	if(param_log_info) {
-		log_info_file.init(type_log, "info", {Log::Field::id, Log::Field::parent, Log::Field::time, Log::Field::try_cnt, Log::Field::cnt, Log::Field::is_html, Log::Field::found, Log::Field::url, Log::Field::charset, Log::Field::msg});
+	uthread.join();
+	while(pop());
+	std::cout.flush();
+}
+
+Arena_str String_arena::add(const std::string& str) {
+	Arena_str ret;
+	ret.size = static_cast<uint32_t>(str.size());
+	if(str.empty()) {
+		return ret;
 	}
-	if(param_log_other) {
-		log_other.init(type_log, "other", {Log::Field::msg});
+	if(str.size() > block_size / 4) {
+		// big strings get their own block, the current one stays open
+		blocks.push_back(Block{std::unique_ptr<char[]>(new char[str.size()]), str.size(), 1});
+		std::memcpy(blocks.back().data.get(), str.data(), str.size());
+		ret.data = blocks.back().data.get();
+		ret.block = static_cast<uint32_t>(blocks.size() - 1);
+		mem += str.size();
+		return ret;
 	}
-	if(sitemap) {
-		if(sitemap_dir.empty()) {
-			throw std::runtime_error("Parameter 'sitemap.dir' is empty");
-		}
-		std::string file_name = sitemap_dir + "/" + xml_name + "1.xml";
-		sitemap_file.open(file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-		if(!sitemap_file.is_open()) {
-			throw std::runtime_error("Can not open " + file_name);
+	if(block_used + str.size() > block_size) {
+		// a full block without strings is not needed any more
+		if(current != no_block && !blocks[current].live) {
+			free(current);
 		}
+		blocks.push_back(Block{std::unique_ptr<char[]>(new char[block_size]), block_size, 0});
+		current = blocks.size() - 1;
+		block_used = 0;
+		mem += block_size;
 	}
+	auto& block = blocks[current];
+	char* dst = block.data.get() + block_used;
+	std::memcpy(dst, str.data(), str.size());
+	block_used += str.size();
+	block.live++;
+	ret.data = dst;
+	ret.block = static_cast<uint32_t>(current);
+	return ret;
 }
 
-std::string Main::uri_normalize(const boost::url& uri) {
-	boost::url u = uri;
-	u.normalize();
-	u.remove_fragment();
-	if(u.port() == "80" || u.port().empty()) {
-		u.remove_port();
-	}
-	if (u.has_authority() && u.encoded_path().empty()) {
-		u.set_path_absolute(true);
+// The string is empty afterwards, nothing may read it any more.
+void String_arena::release(Arena_str& str) {
+	if(!str.data) {
+		return;
 	}
-	if(u.has_query()) {
-		str_vec split_query;
-		boost::split(split_query, u.query(), boost::is_any_of("&"));
-		std::sort(split_query.begin(), split_query.end());
-		u.set_query(boost::join(split_query, "&"));
+	if(!--blocks[str.block].live && str.block != current) {
+		free(str.block);
 	}
-	return u.buffer();
+	str = Arena_str();
 }
 
-bool Main::exit_handler() {
-	std::unique_lock<std::mutex> lk(mutex);
-	std::cout << "Stopping..." << std::endl;
-	running = false;
-	lk.unlock();
-	cond.notify_all();
-	return true;
+void String_arena::free(size_t i) {
+	mem -= blocks[i].size;
+	blocks[i].data.reset();
 }
 
-void Main::start() {
-	std::unique_ptr<Url_struct> url(new Url_struct);
-	url->found = param_url;
-	url->base_href = param_url;
-	url->handle = url_handle_t::query_parse;
-	if(!handle_url(url.get(), false)) {
-		throw std::runtime_error("Parameter 'url' is not valid");
+size_t String_arena::mem_size() const {
+	return mem;
+}
+
+uint32_t String_table::add(const std::string& str) {
+	std::lock_guard<std::mutex> lk(mutex);
+	auto it = index.find(str);
+	if(it != index.end()) {
+		return it->second;
 	}
-	set_url(url);
+	auto id = static_cast<uint32_t>(items.size());
+	items.push_back(str);
+	index.emplace(str, id);
+	return id;
+}
 
-	if(!sys::handle_exit()) {
-		std::cout << "Could not set exit handler" << std::endl;
+std::string String_table::get(uint32_t id) const {
+	std::lock_guard<std::mutex> lk(mutex);
+	return id < items.size() ? items[id] : std::string();
+}
+
+size_t String_table::size() const {
+	std::lock_guard<std::mutex> lk(mutex);
+	return items.size();
+}
+
+size_t String_table::mem_size() const {
+	std::lock_guard<std::mutex> lk(mutex);
+	size_t ret = 0;
+	for(const auto& item : items) {
+		ret += 2 * (item.capacity() + sizeof(std::string)) + 4 * sizeof(void*);
 	}
+	return ret;
+}
 
-	std::vector<Thread> threads;
-	threads.reserve(thread_cnt);
-	for(int i = 0; i < thread_cnt; i++) {
-		threads.emplace_back(i + 1);
-		threads[i].start();
+#ifdef WINDOWS_PLATFORM
+File_map::File_map(const std::string& name) {
+	std::ifstream file(name, std::ifstream::binary | std::ifstream::ate);
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + name);
 	}
-	for(auto& thread : threads) {
-		thread.join();
+	content.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	if(!file.read(content.data(), content.size())) {
+		throw std::runtime_error("Can not read " + name);
 	}
-
+	ptr = content.data();
+	len = content.size();
 }
 
-bool Main::set_url(std::unique_ptr<Url_struct>& url) {
-	std::unique_lock<std::mutex> lk(mutex);
-	if(url_limit && url_all.size() >= url_limit) {
-		if(!url_lim_reached) {
-			if(log_other) {
-				log_other.write({"URL limit reached"});
-			}
-			url_lim_reached = true;
-		}
-		return false;
+File_map::~File_map() {}
+#else
+File_map::File_map(const std::string& name) {
+	int fd = ::open(name.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw std::runtime_error("Can not open " + name);
 	}
-	auto it = url_unique.find(url->normalize);
-	if(it == url_unique.end()) {
-		url_unique[url->normalize] = url_all.size();
-		url->id = static_cast<int>(url_all.size() + 1);
-		if(url->handle == url_handle_t::none) {
-			if(log_skipped_url_file) {
-				log_skipped_url_file.write({url->resolved, std::to_string(url->parent)});
-			}
-			if(log_skipped_url_console) {
-				log_skipped_url_console.write({url->resolved, get_resolved(url->parent)});
-			}
-			url_all.push_back(std::move(url));
-		} else {
-			url_queue.push(url.get());
-			url_all.push_back(std::move(url));
-			lk.unlock();
-			cond.notify_one();
+	struct stat st;
+	if(fstat(fd, &st)) {
+		::close(fd);
+		throw std::runtime_error("Can not read " + name);
+	}
+	len = static_cast<size_t>(st.st_size);
+	if(len) {
+		void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p == MAP_FAILED) {
+			::close(fd);
+			throw std::runtime_error("Can not map " + name);
 		}
-		return true;
-	} else {
-		url_all[it->second]->cnt++;
+		ptr = static_cast<const char*>(p);
 	}
-	return false;
+	::close(fd);
 }
 
-void Main::try_again(Url_struct* url) {
-	std::unique_lock<std::mutex> lk(mutex);
-	url_queue.push(url);
-	lk.unlock();
-	cond.notify_one();
+File_map::~File_map() {
+	if(len) {
+		munmap(const_cast<char*>(ptr), len);
+	}
 }
+#endif
 
-bool Main::get_url(Thread* t) {
-	std::unique_lock<std::mutex> lk(mutex);
-	if(!running) {
-		if(!t->suspend) {
-			t->suspend = true;
-			thread_work--;
-		}
-		return false;
+Seen_table::Seen_table(size_t _size) : size(_size), mem(_size, Seen_slot{0, 0, 0, 0}) {
+	slots = mem.data();
+}
+
+// The file is extended without writing, unwritten parts read as zeros.
+Seen_table::Seen_table(const std::string& name, size_t _size) : size(_size), file_name(name) {
+#ifndef WINDOWS_PLATFORM
+	fd = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		throw std::runtime_error("Can not open " + file_name);
 	}
-	if(url_queue.size()) {
-		if(t->suspend) {
-			t->suspend = false;
-			thread_work++;
+	size_t bytes = size * sizeof(Seen_slot);
+	if(ftruncate(fd, static_cast<off_t>(bytes))) {
+		::close(fd);
+		throw std::runtime_error("Can not write " + file_name);
+	}
+	void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED) {
+		::close(fd);
+		throw std::runtime_error("Can not map " + file_name);
+	}
+	slots = static_cast<Seen_slot*>(p);
+#endif
+}
+
+Seen_table::~Seen_table() {
+#ifndef WINDOWS_PLATFORM
+	if(fd >= 0) {
+		munmap(slots, size * sizeof(Seen_slot));
+		::close(fd);
+		::unlink(file_name.c_str());
+	}
+#endif
+}
+
+Seen_set::~Seen_set() {
+	if(rehash.joinable()) {
+		rehash.join();
+	}
+}
+
+void Seen_set::init(const std::string& _dir, size_t mem_mb, size_t expected) {
+	dir = _dir;
+	if(dir.empty()) {
+		return;
+	}
+#ifdef WINDOWS_PLATFORM
+	throw std::runtime_error("Parameter 'seen_dir' is not supported on this platform");
+#endif
+	size_t bits = std::max<size_t>(mem_mb, 1) * 1024 * 1024 * 8;
+	bloom.assign(bits / 64, 0);
+	// optimal number of hash functions for the expected count
+	bloom_k = static_cast<size_t>(std::round(static_cast<double>(bits) / std::max<size_t>(expected, 1) * std::log(2.0)));
+	bloom_k = std::min<size_t>(std::max<size_t>(bloom_k, 1), 16);
+	table = create(1 << 16);
+}
+
+// Disk tables get a new file for each generation.
+std::shared_ptr<Seen_table> Seen_set::create(size_t size) {
+	if(in_memory()) {
+		return std::make_shared<Seen_table>(size);
+	}
+	return std::make_shared<Seen_table>(dir + "/seen." + std::to_string(generation++) + ".idx", size);
+}
+
+void Seen_set::bloom_add(uint64_t h) {
+	uint64_t h2 = (h >> 33 | h << 31) * 0x9E3779B97F4A7C15ULL | 1;
+	size_t bits = bloom.size() * 64;
+	for(size_t i = 0; i < bloom_k; i++) {
+		size_t bit = (h + i * h2) % bits;
+		bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+bool Seen_set::bloom_test(uint64_t h) const {
+	uint64_t h2 = (h >> 33 | h << 31) * 0x9E3779B97F4A7C15ULL | 1;
+	size_t bits = bloom.size() * 64;
+	for(size_t i = 0; i < bloom_k; i++) {
+		size_t bit = (h + i * h2) % bits;
+		if(!(bloom[bit / 64] & 1ULL << (bit % 64))) {
+			return false;
 		}
-		t->m_url = url_queue.front();
-		url_queue.pop();
-		return true;
 	}
-	if(!t->suspend) {
-		t->suspend = true;
-		thread_work--;
-		if(thread_work == 0) {
-			running = false;
-			lk.unlock();
-			cond.notify_all();
+	return true;
+}
+
+bool Seen_set::table_find(const Slot* slots, size_t size, const Fingerprint& fp, uint32_t& idx) {
+	if(!size) {
+		return false;
+	}
+	size_t mask = size - 1;
+	for(size_t i = fp.lo & mask;; i = (i + 1) & mask) {
+		auto& slot = slots[i];
+		if(!slot.id) {
 			return false;
 		}
+		if(slot.lo == fp.lo && slot.hi == fp.hi) {
+			idx = slot.id - 1;
+			return true;
+		}
+	}
+}
+
+void Seen_set::table_insert(Slot* slots, size_t size, const Slot& slot) {
+	size_t mask = size - 1;
+	for(size_t i = slot.lo & mask;; i = (i + 1) & mask) {
+		if(!slots[i].id) {
+			slots[i] = slot;
+			return;
+		}
+	}
+}
+
+void Seen_set::mem_insert(std::vector<Slot>& table, const Slot& slot) {
+	if(table.empty()) {
+		table.assign(1 << 12, Slot{0, 0, 0, 0});
+	}
+	table_insert(table.data(), table.size(), slot);
+}
+
+bool Seen_set::find(const Fingerprint& fp, uint32_t& idx) {
+	update();
+	if(pending_cnt && table_find(pending.data(), pending.size(), fp, idx)) {
+		return true;
+	}
+	if(in_memory()) {
+		return table && table_find(table->slots, table->size, fp, idx);
+	}
+	if(!bloom_test(fp.lo)) {
+		cnt_absent++;
+		return false;
+	}
+	if(table_find(table->slots, table->size, fp, idx)) {
+		return true;
+	}
+	cnt_absent++;
+	cnt_fp++;
+	return false;
+}
+
+void Seen_set::add(const Fingerprint& fp, uint32_t idx) {
+	update();
+	cnt++;
+	Slot slot{fp.hi, fp.lo, idx + 1, 0};
+	if(!in_memory()) {
+		bloom_add(fp.lo);
+	}
+	if(!table) {
+		table = create(1 << 12);
+	}
+	if(!next && !table->readers.load(std::memory_order_acquire) && cnt > table->size / 2) {
+		grow();
+	}
+	if(next || table->readers.load(std::memory_order_acquire)) {
+		if(pending_cnt + 1 > pending.size() / 2) {
+			std::vector<Slot> larger(std::max<size_t>(pending.size() * 2, 1 << 12), Slot{0, 0, 0, 0});
+			for(const auto& s : pending) {
+				if(s.id) {
+					table_insert(larger.data(), larger.size(), s);
+				}
+			}
+			pending.swap(larger);
+		}
+		mem_insert(pending, slot);
+		pending_cnt++;
+		return;
+	}
+	table_insert(table->slots, table->size, slot);
+}
+
+// Takes the table of a finished rehash, then grows or moves pending
+// slots when the table has no readers.
+void Seen_set::update() {
+	if(next && rehash_done.load(std::memory_order_acquire)) {
+		rehash.join();
+		table = std::move(next);
+		next.reset();
+	}
+	if(next || !table || table->readers.load(std::memory_order_acquire)) {
+		return;
+	}
+	if(cnt > table->size / 2) {
+		grow();
+	} else if(pending_cnt) {
+		merge_pending();
+	}
+}
+
+// A memory table is copied in place. The old disk table is read
+// sequentially by a thread into a table of twice the size, the lock
+// is not held meanwhile and pending slots are merged when it is done.
+void Seen_set::grow() {
+	size_t size = table->size * 2;
+	while(size / 2 < cnt) {
+		size *= 2;
+	}
+	if(in_memory()) {
+		auto larger = create(size);
+		for(size_t i = 0; i < table->size; i++) {
+			if(table->slots[i].id) {
+				table_insert(larger->slots, larger->size, table->slots[i]);
+			}
+		}
+		table = larger;
+		merge_pending();
+		return;
 	}
-	cond.wait(lk, [this] {
-		return !running || url_queue.size();
+	next = create(size);
+	rehash_done = false;
+	table->readers++;
+	auto from = table;
+	auto to = next;
+	rehash = std::thread([this, from, to] {
+#ifndef WINDOWS_PLATFORM
+		madvise(from->slots, from->size * sizeof(Slot), MADV_SEQUENTIAL);
+#endif
+		for(size_t i = 0; i < from->size; i++) {
+			if(from->slots[i].id) {
+				table_insert(to->slots, to->size, from->slots[i]);
+			}
+		}
+		from->readers.fetch_sub(1, std::memory_order_release);
+		rehash_done.store(true, std::memory_order_release);
 	});
-	return true;
 }
 
-std::string Main::get_resolved(int i) {
-	if(i <= 0) {
+void Seen_set::merge_pending() {
+	for(const auto& s : pending) {
+		if(s.id) {
+			table_insert(table->slots, table->size, s);
+		}
+	}
+	pending.clear();
+	pending.shrink_to_fit();
+	pending_cnt = 0;
+}
+
+size_t Seen_set::mem_size() const {
+	size_t ret = pending.size() * sizeof(Slot);
+	if(in_memory()) {
+		return ret + (table ? table->size * sizeof(Slot) : 0);
+	}
+	return ret + bloom.size() * sizeof(uint64_t);
+}
+
+std::string Seen_set::stats() const {
+	if(in_memory()) {
 		return "";
 	}
+	double bits = static_cast<double>(bloom.size() * 64);
+	double expected = std::pow(1 - std::exp(-static_cast<double>(bloom_k * cnt) / bits), static_cast<double>(bloom_k));
+	std::stringstream str;
+	str << std::fixed << std::setprecision(4);
+	str << "Seen set: " << cnt << " urls, bloom " << bloom.size() * sizeof(uint64_t) / (1024 * 1024) << " MB, k = " << bloom_k;
+	str << ", false positive rate " << (cnt_absent ? 100.0 * cnt_fp / cnt_absent : 0.0) << "% (expected " << 100 * expected << "%)";
+	return str.str();
+}
+
+// Pending slots are copied, the table is held unchanged.
+Seen_snapshot Seen_set::snapshot() {
+	std::vector<Slot> slots;
+	slots.reserve(pending_cnt);
+	for(const auto& slot : pending) {
+		if(slot.id) {
+			slots.push_back(slot);
+		}
+	}
+	if(table) {
+		table->readers++;
+	}
+	return Seen_snapshot(table, std::move(slots));
+}
+
+Seen_snapshot::Seen_snapshot(std::shared_ptr<Seen_table> _table, std::vector<Seen_slot> _pending) : table(std::move(_table)), pending(std::move(_pending)) {}
+
+Seen_snapshot::~Seen_snapshot() {
+	if(table) {
+		table->readers.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+// Adds the slots of a checkpoint, false if size does not fit.
+bool Seen_set::load(const char* data, size_t size) {
+	if(size % sizeof(Slot)) {
+		return false;
+	}
+	// sized at once so that no rehash runs while loading
+	size_t n = size / sizeof(Slot);
+	size_t table_size = 1 << 16;
+	while(table_size / 2 < n + 1) {
+		table_size *= 2;
+	}
+	table = create(table_size);
+	for(size_t i = 0; i < n; i++) {
+		Slot slot;
+		std::memcpy(&slot, data + i * sizeof(Slot), sizeof(Slot));
+		Fingerprint fp;
+		fp.hi = slot.hi;
+		fp.lo = slot.lo;
+		add(fp, slot.id - 1);
+	}
+	return true;
+}
+
+std::string Url_struct::path() const {
+	if(!path_len) {
+		return "/";
+	}
+	if(resolved.data[path_pos] == '?') {
+		return "/" + std::string(resolved.data + path_pos, path_len);
+	}
+	return std::string(resolved.data + path_pos, path_len);
+}
+
+Url_store::Url_store() : blocks(new std::atomic<Url_struct*>[max_blocks]) {
+	for(size_t i = 0; i < max_blocks; i++) {
+		blocks[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+Url_store::~Url_store() {
+	for(size_t i = 0; i < block_cnt; i++) {
+		delete[] blocks[i].load();
+	}
+}
+
+Url_struct* Url_store::add() {
+	if(cnt == block_cnt * block_size) {
+		if(block_cnt == max_blocks) {
+			throw std::runtime_error("URL store is full");
+		}
+		blocks[block_cnt++].store(new Url_struct[block_size], std::memory_order_release);
+	}
+	return (*this)[cnt++];
+}
+
+std::string Client_pool::key(const Url_struct* url) const {
+	std::string ret(url->ssl ? "https" : "http");
+	ret += "://" + main_obj.hosts.get(url->host);
+	if(!main_obj.param_interface.empty()) {
+		ret += "@" + main_obj.param_interface;
+	}
+	return ret;
+}
+
+std::shared_ptr<httplib::Client> Client_pool::create(const Url_struct* url) const {
+	std::string scheme_host(url->ssl ? "https" : "http");
+	scheme_host += "://" + main_obj.hosts.get(url->host);
+	auto cli = std::make_shared<httplib::Client>(scheme_host);
+	cli->set_keep_alive(main_obj.keep_alive);
+	// bodies are decoded while they are parsed
+	cli->set_decompress(false);
+	if(!main_obj.param_interface.empty()) {
+		cli->set_interface(main_obj.param_interface.data());
+	}
+	if(url->ssl) {
+		cli->enable_server_certificate_verification(main_obj.cert_verification);
+		if(main_obj.cert_verification) {
+			if(!main_obj.ca_cert_file_path.empty()) {
+				cli->set_ca_cert_path(main_obj.ca_cert_file_path.c_str());
+			}
+			if(!main_obj.ca_cert_dir_path.empty()) {
+				cli->set_ca_cert_path(nullptr, main_obj.ca_cert_dir_path.c_str());
+			}
+		}
+	}
+	return cli;
+}
+
+// Concurrency per host is left to host_limit, pool_host_limit caps only
+// the idle list. Clients are closed after unlocking, Closed is declared
+// before the lock for that.
+std::shared_ptr<httplib::Client> Client_pool::get(const Url_struct* url) {
+	Closed closed;
+	auto k = key(url);
+	auto now = clock_::now();
 	std::unique_lock<std::mutex> lk(mutex);
-	return url_all[i - 1]->resolved;
+	evict(now, closed);
+	if(main_obj.keep_alive) {
+		auto it = idle.find(k);
+		if(it != idle.end() && !it->second.empty()) {
+			auto cli = std::move(it->second.back().cli);
+			it->second.pop_back();
+			cnt_reuse++;
+			return cli;
+		}
+	}
+	cnt_new++;
+	lk.unlock();
+	return create(url);
+}
+
+// A client is kept only when reuse is set and the connection is still usable.
+void Client_pool::put(const Url_struct* url, std::shared_ptr<httplib::Client>& cli, bool reuse) {
+	Closed closed;
+	auto k = key(url);
+	auto now = clock_::now();
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		if(cli && reuse && main_obj.keep_alive && main_obj.pool_host_limit) {
+			auto& list = idle[k];
+			// the oldest connection is the first to be closed by the server anyway
+			if(list.size() >= main_obj.pool_host_limit) {
+				closed.push_back(std::move(list.front().cli));
+				list.erase(list.begin());
+			}
+			list.push_back({std::move(cli), now});
+		} else if(cli) {
+			closed.push_back(std::move(cli));
+		}
+		evict(now, closed);
+	}
+}
+
+void Client_pool::evict(clock_::time_point now, Closed& closed) {
+	auto timeout = std::chrono::seconds(main_obj.pool_idle_timeout);
+	if(now - last_evict < timeout / 2) {
+		return;
+	}
+	last_evict = now;
+	for(auto it = idle.begin(); it != idle.end();) {
+		auto& list = it->second;
+		auto end = std::remove_if(list.begin(), list.end(), [&](const Idle& i) {
+			return now - i.time > timeout;
+		});
+		for(auto i = end; i != list.end(); ++i) {
+			closed.push_back(std::move(i->cli));
+		}
+		list.erase(end, list.end());
+		if(list.empty()) {
+			it = idle.erase(it);
+		} else {
+			++it;
+		}
+	}
 }
 
-bool Main::handle_url(Url_struct* url_new, bool filter) {
+void Client_pool::count(bool reused) {
+	std::lock_guard<std::mutex> lk(mutex);
+	if(reused) {
+		cnt_reuse++;
+	} else {
+		cnt_new++;
+	}
+}
 
-	std::string found = std::regex_replace(url_new->found, std::regex(R"(^\s+|\s+$)"), std::string(""));
+void Frontier::init(size_t workers, int delay_ms, size_t host_limit) {
+	queues.clear();
+	for(size_t i = 0; i < std::max<size_t>(workers, 1); i++) {
+		queues.emplace_back(new Queue);
+	}
+	delay = std::chrono::milliseconds(delay_ms);
+	limit = host_limit;
+	polite = delay_ms > 0 || host_limit > 0;
+}
 
-	// ----- resolve
-	boost::system::result<boost::url> rb = boost::urls::parse_uri_reference(url_new->base_href);
-	boost::system::result<boost::url> rd = boost::urls::parse_uri_reference(found);
-	if(!rb) {
-		if(log_bad_url_file) {
-			log_bad_url_file.write({url_new->base_href, std::to_string(url_new->parent)});
+void Frontier::push(Url_struct* url, int worker) {
+	if(polite) {
+		std::lock_guard<std::mutex> lk(mutex);
+		if(url->host >= hosts.size()) {
+			hosts.resize(url->host + 1);
 		}
-		if(log_bad_url_console) {
-			log_bad_url_console.write({url_new->base_href, get_resolved(url_new->parent)});
+		hosts[url->host].urls.push_back(url);
+		cnt++;
+		schedule(url->host, clock_::now());
+		return;
+	}
+	size_t i = worker < 0 ? next++ % queues.size() : worker % queues.size();
+	{
+		std::lock_guard<std::mutex> lk(queues[i]->mutex);
+		queues[i]->urls.push_back(url);
+	}
+	cnt++;
+}
+
+Url_struct* Frontier::pop(int worker) {
+	if(!cnt.load()) {
+		return nullptr;
+	}
+	if(polite) {
+		return pop_host();
+	}
+	size_t n = queues.size();
+	size_t own = worker < 0 ? 0 : worker % n;
+	{
+		auto& q = *queues[own];
+		std::lock_guard<std::mutex> lk(q.mutex);
+		if(!q.urls.empty()) {
+			auto url = q.urls.front();
+			q.urls.pop_front();
+			cnt--;
+			return url;
 		}
 	}
-	if(!rd) {
-		if(log_bad_url_file) {
-			log_bad_url_file.write({url_new->found, std::to_string(url_new->parent)});
+	for(size_t i = 1; i < n; i++) {
+		auto& q = *queues[(own + i) % n];
+		std::lock_guard<std::mutex> lk(q.mutex);
+		if(!q.urls.empty()) {
+			auto url = q.urls.back();
+			q.urls.pop_back();
+			cnt--;
+			return url;
 		}
-		if(log_bad_url_console) {
-			log_bad_url_console.write({url_new->found, get_resolved(url_new->parent)});
+	}
+	return nullptr;
+}
+
+Url_struct* Frontier::pop_host() {
+	std::lock_guard<std::mutex> lk(mutex);
+	auto now = clock_::now();
+	while(!delayed.empty() && delayed.top().first <= now) {
+		auto id = delayed.top().second;
+		delayed.pop();
+		hosts[id].queued = false;
+		schedule(id, now);
+	}
+	Url_struct* url = nullptr;
+	while(!url && !ready_hosts.empty()) {
+		auto id = ready_hosts.front();
+		ready_hosts.pop_front();
+		auto& h = hosts[id];
+		h.queued = false;
+		// a finished request may have pushed the host back
+		if(h.next <= now) {
+			url = h.urls.front();
+			h.urls.pop_front();
+			h.active++;
+			h.next = now + delay;
+			cnt--;
 		}
-		return false;
+		schedule(id, now);
 	}
-	if(!rb || !rd) {
-		return false;
+	ready_cnt = ready_hosts.size();
+	return url;
+}
+
+void Frontier::release(const Url_struct* url) {
+	if(!polite) {
+		return;
 	}
-	boost::url b = rb.value();
-	boost::url d = rd.value();
-	b.resolve(d);
+	std::lock_guard<std::mutex> lk(mutex);
+	auto& h = hosts[url->host];
+	h.active--;
+	h.next = std::max(h.next, clock_::now() + delay);
+	schedule(url->host, clock_::now());
+}
 
-	// ----- base filter
-	if(!b.scheme().starts_with("http")) {
-		return false;
+// Puts the host in the ready list or the delayed heap. A host at its
+// limit waits for release instead.
+void Frontier::schedule(uint32_t id, clock_::time_point now) {
+	auto& h = hosts[id];
+	if(h.queued || h.urls.empty() || (limit && h.active >= limit)) {
+		return;
 	}
-	auto d_host = d.host();
-	auto b_host = uri.host();
-	if(d_host.empty()) {
-		return false;
+	h.queued = true;
+	if(h.next <= now) {
+		ready_hosts.push_back(id);
+		ready_cnt = ready_hosts.size();
+	} else {
+		delayed.emplace(h.next, id);
 	}
-	std::size_t i = d_host.find(b_host);
-	if(i == std::string::npos || i != d_host.size() - b_host.size()) {
+}
+
+Frontier::clock_::time_point Frontier::next_due() {
+	if(!polite) {
+		return clock_::time_point::max();
+	}
+	std::lock_guard<std::mutex> lk(mutex);
+	return delayed.empty() ? clock_::time_point::max() : delayed.top().first;
+}
+
+void Retry_queue::push(Url_struct* url, int worker, clock_::duration delay) {
+	std::lock_guard<std::mutex> lk(mutex);
+	Item item;
+	item.time = clock_::now() + delay;
+	item.url = url;
+	item.worker = worker;
+	items.push(item);
+	cnt++;
+	due = items.top().time.time_since_epoch().count();
+}
+
+bool Retry_queue::move_due(Frontier& frontier) {
+	auto now = clock_::now();
+	if(now.time_since_epoch().count() < due.load()) {
 		return false;
 	}
+	std::lock_guard<std::mutex> lk(mutex);
+	bool moved = false;
+	while(!items.empty() && items.top().time <= now) {
+		// push before the count drops, the url is never in neither queue
+		frontier.push(items.top().url, items.top().worker);
+		items.pop();
+		cnt--;
+		moved = true;
+	}
+	due = items.empty() ? clock_::time_point::max().time_since_epoch().count() : items.top().time.time_since_epoch().count();
+	return moved;
+}
+
+static const uint64_t murmur_c1 = 0x87c37b91114253d5ULL;
+static const uint64_t murmur_c2 = 0x4cf5ad432745937fULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+void Content_index::init(size_t mem_mb, int dist) {
+	distance = dist;
+	// a band has at most 65536 buckets, more memory makes buckets larger
+	size_t entries = std::max<size_t>(mem_mb, 1) * 1024 * 1024 / sizeof(Entry) / bands;
+	slots = std::min<size_t>(std::max<size_t>(entries / 65536, 1), 256);
+	table.assign(bands * 65536 * slots, Entry{0, 0, 0, 0});
+	next.assign(bands * 65536, 0);
+}
+
+// Word 3-shingles of the text, each shingle votes on all 64 bits. Tags,
+// comments, scripts and styles are skipped, pages sharing a template
+// differ in their text only. cnt is the number of shingles.
+uint64_t Content_index::simhash(const char* p, size_t size, size_t& cnt) {
+	auto word = [](char c) {
+		return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || static_cast<unsigned char>(c) >= 0x80;
+	};
+	const char* end = p + size;
+	auto starts = [&end](const char* s, const char* str) {
+		for(; *str; s++, str++) {
+			if(s == end || (*s | 0x20) != *str) {
+				return false;
+			}
+		}
+		return true;
+	};
+	// skips to the end of the markup at p
+	auto skip = [&](const char* s) {
+		const char* close = nullptr;
+		if(starts(s, "<!--")) {
+			close = "-->";
+		} else if(starts(s, "<script")) {
+			close = "</script";
+		} else if(starts(s, "<style")) {
+			close = "</style";
+		}
+		if(close) {
+			s = std::search(s + 1, end, close, close + std::strlen(close), [](char a, char b) {
+				return (a | 0x20) == (b | 0x20);
+			});
+		}
+		s = static_cast<const char*>(std::memchr(s, '>', end - s));
+		return s ? s + 1 : end;
+	};
+	int32_t v[64] = {};
+	uint64_t h0 = 0;
+	uint64_t h1 = 0;
+	cnt = 0;
+	while(true) {
+		while(p < end && !word(*p)) {
+			p = *p == '<' ? skip(p) : p + 1;
+		}
+		if(p == end) {
+			break;
+		}
+		uint64_t t = 0xcbf29ce484222325ULL;
+		for(; p < end && word(*p); p++) {
+			t = (t ^ static_cast<unsigned char>(*p)) * 0x100000001b3ULL;
+		}
+		uint64_t f = fmix64(t ^ rotl64(h1, 1) ^ rotl64(h0, 2));
+		h0 = h1;
+		h1 = t;
+		cnt++;
+		for(int i = 0; i < 64; i++) {
+			v[i] += (f >> i & 1) ? 1 : -1;
+		}
+	}
+	uint64_t ret = 0;
+	for(int i = 0; i < 64; i++) {
+		if(v[i] > 0) {
+			ret |= 1ULL << i;
+		}
+	}
+	return ret;
+}
 
-	// ----- user filter
-	if(filter) {
-		if(!param_subdomain && d_host != b_host) {
+// Id of a url with the same or a near body, 0 if there is none and the
+// body is added. same tells an exact copy from a near one, exact copies
+// are looked for in all buckets first.
+int Content_index::find_add(const Fingerprint& exact, uint64_t sim, int id, bool& same) {
+	std::lock_guard<std::mutex> lk(mutex);
+	cnt++;
+	same = true;
+	for(size_t b = 0; b < bands; b++) {
+		size_t bucket = b * 65536 + (sim >> (b * 16) & 0xffff);
+		const Entry* e = &table[bucket * slots];
+		for(size_t i = 0; i < slots; i++) {
+			// a retried page may find itself
+			if(e[i].id && e[i].id != id && e[i].exact == exact.lo) {
+				cnt_exact++;
+				return e[i].id;
+			}
+		}
+	}
+	same = false;
+	for(size_t b = 0; b < bands; b++) {
+		size_t bucket = b * 65536 + (sim >> (b * 16) & 0xffff);
+		const Entry* e = &table[bucket * slots];
+		for(size_t i = 0; i < slots; i++) {
+			if(!e[i].id || e[i].id == id) {
+				continue;
+			}
+			uint64_t x = e[i].sim ^ sim;
+			int d = 0;
+			for(; x && d <= distance; d++) {
+				x &= x - 1;
+			}
+			if(d <= distance) {
+				cnt_near++;
+				return e[i].id;
+			}
+		}
+	}
+	for(size_t b = 0; b < bands; b++) {
+		size_t bucket = b * 65536 + (sim >> (b * 16) & 0xffff);
+		table[bucket * slots + next[bucket]++ % slots] = Entry{exact.lo, sim, id, 0};
+	}
+	return 0;
+}
+
+std::string Content_index::stats() const {
+	if(table.empty()) {
+		return "";
+	}
+	std::stringstream str;
+	str << std::fixed << std::setprecision(2);
+	str << "Content dedup: " << cnt_exact + cnt_near << " of " << cnt << " pages duplicate (" << cnt_exact << " exact, " << cnt_near << " near), hit rate " << (cnt ? 100.0 * (cnt_exact + cnt_near) / cnt : 0.0) << "%";
+	return str.str();
+}
+
+const std::string& Decoder::accepted() {
+	static const std::string encodings = [] {
+		std::string ret;
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+		ret += "br";
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+		ret += ret.empty() ? "gzip, deflate" : ", gzip, deflate";
+#endif
+		return ret;
+	}();
+	return encodings;
+}
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+void Decoder::Zlib_end::operator()(z_stream* z) const {
+	inflateEnd(z);
+	delete z;
+}
+#endif
+
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+void Decoder::Brotli_end::operator()(BrotliDecoderState* s) const {
+	BrotliDecoderDestroyInstance(s);
+}
+#endif
+
+// False if the encoding is not supported, identity needs no decoder.
+bool Decoder::init(const std::string& encoding) {
+	type = none;
+	end = false;
+	auto enc = boost::to_lower_copy(boost::trim_copy(encoding));
+	if(enc.empty() || enc == "identity") {
+		return true;
+	}
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	if(enc == "gzip" || enc == "x-gzip" || enc == "deflate") {
+		std::unique_ptr<z_stream, Zlib_end> z(new z_stream());
+		// 32 detects a gzip or zlib header
+		if(inflateInit2(z.get(), 15 + 32) != Z_OK) {
+			delete z.release();
+			return false;
+		}
+		zs = std::move(z);
+		head.clear();
+		first = true;
+		type = zlib;
+		return true;
+	}
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	if(enc == "br") {
+		br.reset(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr));
+		if(!br) {
 			return false;
 		}
-		for(auto it_filter = param_filter.begin() ; it_filter != param_filter.end(); ++it_filter) {
-			bool res = true;
-			bool check = false;
-			if((*it_filter).type == Filter::type_regexp) {
-				check = true;
-				res = std::regex_search(b.buffer().data(), (*it_filter).reg);
-			} else if((*it_filter).type == Filter::type_get) {
-				if(b.has_query()) {
-					str_vec split_query;
-					boost::split(split_query, b.query(), boost::is_any_of("&"));
-					check = true;
-					res = false;
-					for(auto i : split_query) {
-						str_vec query_kv;
-						boost::split(query_kv, i, boost::is_any_of("="));
-						if(query_kv[0] == (*it_filter).val) {
-							res = true;
-							break;
-						}
-					}
-				}
-			} else if((*it_filter).type == Filter::type_ext) {
-				std::string elem;
-				std::string ext;
-				auto elems = b.segments();
-				if(!elems.empty()) {
-					auto pos = elems.back().find_last_of('.');
-					if(pos != std::string::npos) {
-						ext = elems.back().substr(pos + 1);
-					}
-				}
-				if(!ext.empty()) {
-					check = true;
-					res = ext == (*it_filter).val;
-				}
-			}
-			if(check) {
-				if((*it_filter).dir == Filter::exclude && res) {
-					return false;
-				}
-				if((*it_filter).dir == Filter::include && !res) {
-					return false;
-				}
-				if((*it_filter).dir == Filter::skip && res) {
-					if(url_new->handle == url_handle_t::query_parse) {
-						url_new->handle = url_handle_t::none;
-					}
-				}
-			}
+		type = brotli;
+		return true;
+	}
+#endif
+	return false;
+}
+
+bool Decoder::feed(const char* data, size_t size, const Output& out) {
+	char buf[16384];
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	if(type == zlib) {
+		auto z = zs.get();
+		if(first) {
+			head.append(data, size);
+		}
+		z->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		z->avail_in = static_cast<uInt>(size);
+		do {
+			z->next_out = reinterpret_cast<Bytef*>(buf);
+			z->avail_out = sizeof(buf);
+			int ret = inflate(z, Z_NO_FLUSH);
+			if(ret == Z_DATA_ERROR && first) {
+				// some servers send deflate without the zlib header
+				first = false;
+				if(inflateReset2(z, -15) != Z_OK) {
+					return false;
+				}
+				std::string raw;
+				raw.swap(head);
+				return feed(raw.data(), raw.size(), out);
+			}
+			if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				return false;
+			}
+			size_t n = sizeof(buf) - z->avail_out;
+			if(n) {
+				first = false;
+				head.clear();
+				out(buf, n);
+			}
+			if(ret == Z_STREAM_END) {
+				end = true;
+				break;
+			}
+			if(ret == Z_BUF_ERROR) {
+				break;
+			}
+		} while(z->avail_in || !z->avail_out);
+		return true;
+	}
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	if(type == brotli) {
+		size_t avail_in = size;
+		auto next_in = reinterpret_cast<const uint8_t*>(data);
+		while(true) {
+			size_t avail_out = sizeof(buf);
+			auto next_out = reinterpret_cast<uint8_t*>(buf);
+			auto ret = BrotliDecoderDecompressStream(br.get(), &avail_in, &next_in, &avail_out, &next_out, nullptr);
+			if(ret == BROTLI_DECODER_RESULT_ERROR) {
+				return false;
+			}
+			size_t n = sizeof(buf) - avail_out;
+			if(n) {
+				out(buf, n);
+			}
+			if(ret == BROTLI_DECODER_RESULT_SUCCESS) {
+				end = true;
+				return true;
+			}
+			if(ret == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+				return true;
+			}
+		}
+	}
+#endif
+	out(data, size);
+	return true;
+}
+
+void Transfer_stats::add(uint32_t host, uint64_t wire, uint64_t body) {
+	std::lock_guard<std::mutex> lk(mutex);
+	if(host >= hosts.size()) {
+		hosts.resize(host + 1);
+	}
+	hosts[host].wire += wire;
+	hosts[host].body += body;
+}
+
+// Totals and the hosts with the most received bytes.
+str_vec Transfer_stats::summary(const String_table& names) const {
+	std::lock_guard<std::mutex> lk(mutex);
+	str_vec ret;
+	Bytes total;
+	std::vector<uint32_t> order;
+	for(uint32_t i = 0; i < hosts.size(); i++) {
+		if(hosts[i].wire) {
+			total.wire += hosts[i].wire;
+			total.body += hosts[i].body;
+			order.push_back(i);
+		}
+	}
+	if(!total.wire) {
+		return ret;
+	}
+	auto line = [](const std::string& name, const Bytes& b) {
+		std::stringstream str;
+		str << std::fixed << std::setprecision(2);
+		str << name << static_cast<double>(b.wire) / (1024 * 1024) << " MB received, " << static_cast<double>(b.body) / (1024 * 1024) << " MB decoded";
+		if(b.body) {
+			str << " (" << 100.0 * (1.0 - static_cast<double>(b.wire) / b.body) << "% saved)";
+		}
+		return str.str();
+	};
+	ret.push_back(line("Transfer: ", total));
+	size_t top = std::min<size_t>(order.size(), 10);
+	std::partial_sort(order.begin(), order.begin() + top, order.end(), [this](uint32_t a, uint32_t b) {
+		return hosts[a].wire > hosts[b].wire;
+	});
+	for(size_t i = 0; i < top && order.size() > 1; i++) {
+		ret.push_back(line("  " + names.get(order[i]) + ": ", hosts[order[i]]));
+	}
+	return ret;
+}
+
+void Page_state::add_link(url_handle_t handle, const std::string& url) {
+	uint32_t size = static_cast<uint32_t>(url.size());
+	links += static_cast<char>(handle);
+	links.append(reinterpret_cast<const char*>(&size), sizeof(size));
+	links += url;
+}
+
+// Record: url hash, content hash, lastmod, then etag, last_modified,
+// charset and links, each as [uint32_t size][data].
+// Returns the end of the record at p, nullptr if it does not fit in the
+// file. state gets the fields if set.
+const char* Recrawl_store::parse(const char* p, Page_state* state) const {
+	const char* end = map->data() + map->size();
+	auto read = [&](void* dest, size_t size) {
+		if(static_cast<size_t>(end - p) < size) {
+			return false;
+		}
+		if(dest) {
+			std::memcpy(dest, p, size);
+		}
+		p += size;
+		return true;
+	};
+	auto read_str = [&](std::string* str) {
+		uint32_t size;
+		if(!read(&size, sizeof(size)) || static_cast<size_t>(end - p) < size) {
+			return false;
+		}
+		if(str) {
+			str->assign(p, size);
+		}
+		p += size;
+		return true;
+	};
+	bool ok = read(nullptr, sizeof(Fingerprint)) &&
+		read(state ? &state->hash : nullptr, sizeof(state->hash)) &&
+		read(state ? &state->lastmod : nullptr, sizeof(state->lastmod)) &&
+		read_str(state ? &state->etag : nullptr) &&
+		read_str(state ? &state->last_modified : nullptr) &&
+		read_str(state ? &state->charset : nullptr) &&
+		read_str(state ? &state->links : nullptr);
+	return ok ? p : nullptr;
+}
+
+void Recrawl_store::open(const std::string& name) {
+	file_name = name;
+	if(utils::file_exists(file_name)) {
+		map.reset(new File_map(file_name));
+		auto invalid = std::runtime_error("Recrawl file " + file_name + " is not valid");
+		if(map->size() < 8 || std::memcmp(map->data(), "SMRCRL1", 8)) {
+			throw invalid;
+		}
+		// records are checked and indexed, fields are not copied
+		std::vector<uint64_t> offsets;
+		const char* begin = map->data();
+		const char* end = begin + map->size();
+		for(const char* p = begin + 8; p < end;) {
+			offsets.push_back(p - begin);
+			p = parse(p, nullptr);
+			if(!p) {
+				throw invalid;
+			}
+		}
+		size_t size = 16;
+		while(size < offsets.size() * 2) {
+			size <<= 1;
+		}
+		index.assign(size, Slot{Fingerprint(), 0});
+		for(auto offset : offsets) {
+			Fingerprint key;
+			std::memcpy(&key, begin + offset, sizeof(key));
+			// a later record of the same url wins
+			for(size_t i = key.lo & (size - 1);; i = (i + 1) & (size - 1)) {
+				if(!index[i].offset) {
+					known++;
+				} else if(!(index[i].key == key)) {
+					continue;
+				}
+				index[i] = Slot{key, offset};
+				break;
+			}
+		}
+	}
+	// a resumed run continues the states written before it was stopped
+	std::string new_name = file_name + ".new";
+	bool append = main_obj.resume && utils::file_exists(new_name);
+	buffer.resize(utils::file_buffer_size);
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	file.open(new_name, std::ofstream::out | std::ofstream::binary | (append ? std::ofstream::app : std::ofstream::trunc));
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + new_name);
+	}
+	if(!append) {
+		file.write("SMRCRL1", 8);
+	}
+}
+
+// The new file replaces the old one only when the crawl is complete.
+void Recrawl_store::close(bool complete) {
+	if(!file.is_open()) {
+		return;
+	}
+	file.close();
+	std::string new_name = file_name + ".new";
+	if(!file) {
+		throw std::runtime_error("Can not write " + new_name);
+	}
+	if(complete && std::rename(new_name.c_str(), file_name.c_str())) {
+		throw std::runtime_error("Can not rename " + new_name);
+	}
+}
+
+bool Recrawl_store::find(const Url_struct* url, Page_state& state) const {
+	if(!known || url->handle != url_handle_t::query_parse) {
+		return false;
+	}
+	auto key = utils::hash128(url->resolved.data, url->resolved.size);
+	size_t mask = index.size() - 1;
+	for(size_t i = key.lo & mask; index[i].offset; i = (i + 1) & mask) {
+		if(index[i].key == key) {
+			parse(map->data() + index[i].offset, &state);
+			return true;
+		}
+	}
+	return false;
+}
+
+void Recrawl_store::add(const Url_struct* url, const Page_state& state) {
+	std::string rec;
+	auto key = utils::hash128(url->resolved.data, url->resolved.size);
+	auto add_str = [&rec](const std::string& str) {
+		uint32_t size = static_cast<uint32_t>(str.size());
+		rec.append(reinterpret_cast<const char*>(&size), sizeof(size));
+		rec += str;
+	};
+	rec.append(reinterpret_cast<const char*>(&key), sizeof(key));
+	rec.append(reinterpret_cast<const char*>(&state.hash), sizeof(state.hash));
+	rec.append(reinterpret_cast<const char*>(&state.lastmod), sizeof(state.lastmod));
+	add_str(state.etag);
+	add_str(state.last_modified);
+	add_str(state.charset);
+	add_str(state.links);
+	std::lock_guard<std::mutex> lk(mutex);
+	file.write(rec.data(), rec.size());
+	saved++;
+}
+
+std::string Recrawl_store::stats() const {
+	if(file_name.empty()) {
+		return "";
+	}
+	return "Recrawl: " + std::to_string(unchanged.load()) + " of " + std::to_string(known) + " known pages unchanged, " + std::to_string(saved) + " pages saved";
+}
+
+size_t Client_pool::get_cnt_new() const {
+	std::lock_guard<std::mutex> lk(mutex);
+	return cnt_new;
+}
+
+size_t Client_pool::get_cnt_reuse() const {
+	std::lock_guard<std::mutex> lk(mutex);
+	return cnt_reuse;
+}
+
+void Filter::add(const std::string& filter) {
+	str_vec v;
+	boost::split(v, filter, boost::is_any_of(" "));
+	if(v.size() != 3) {
+		throw std::runtime_error("Parameter 'filter' (" + filter + ") is not valid");
+	}
+	int dir;
+	if(v[1] == "include") {
+		dir = include;
+	} else if(v[1] == "exclude") {
+		dir = exclude;
+	} else if(v[1] == "skip") {
+		dir = skip;
+	} else {
+		throw std::runtime_error("Parameter 'filter' (" + filter + ") is not valid");
+	}
+	auto& r = rules[dir];
+	if(v[0] == "regexp") {
+		std::regex reg;
+		try {
+			reg = std::regex(v[2], std::regex_constants::ECMAScript | std::regex_constants::icase);
+		} catch(std::exception& e) {
+			throw std::runtime_error(std::string("Parameter 'filter' (" + filter + ") is not valid: ") + e.what());
+		}
+		// group numbers change when patterns are joined, so backreferences stay alone
+		static const std::regex backref(R"(\\[1-9])");
+		if(dir == include || std::regex_search(v[2], backref)) {
+			r.reg.push_back(std::move(reg));
+		} else {
+			r.patterns.push_back(v[2]);
+		}
+	} else if(v[0] == "get") {
+		r.get.insert(v[2]);
+		has_get = true;
+	} else if(v[0] == "ext") {
+		r.ext.insert(v[2]);
+		has_ext = true;
+	} else {
+		throw std::runtime_error("Parameter 'filter' (" + filter + ") is not valid");
+	}
+}
+
+void Filter::compile() {
+	for(auto& r : rules) {
+		if(r.patterns.empty()) {
+			continue;
+		}
+		std::string joined;
+		for(const auto& p : r.patterns) {
+			if(!joined.empty()) {
+				joined += '|';
+			}
+			joined += "(?:" + p + ")";
+		}
+		r.reg.emplace_back(joined, std::regex_constants::ECMAScript | std::regex_constants::icase | std::regex_constants::optimize);
+		r.patterns.clear();
+	}
+}
+
+// Returns false if the url must not be handled, skip is set if it must not be visited.
+bool Filter::check(const boost::url& b, bool& skip_url) const {
+	const char* first = b.buffer().data();
+	const char* last = first + b.buffer().size();
+	for(const auto& reg : rules[exclude].reg) {
+		if(std::regex_search(first, last, reg)) {
+			return false;
+		}
+	}
+	for(const auto& reg : rules[include].reg) {
+		if(!std::regex_search(first, last, reg)) {
+			return false;
+		}
+	}
+	if(has_get && b.has_query()) {
+		std::unordered_set<std::string> keys;
+		std::string query = b.query();
+		size_t pos = 0;
+		while(pos <= query.size()) {
+			size_t end = query.find('&', pos);
+			if(end == std::string::npos) {
+				end = query.size();
+			}
+			size_t eq = query.find('=', pos);
+			keys.insert(query.substr(pos, std::min(eq, end) - pos));
+			pos = end + 1;
+		}
+		for(const auto& key : rules[exclude].get) {
+			if(keys.count(key)) {
+				return false;
+			}
+		}
+		for(const auto& key : rules[include].get) {
+			if(!keys.count(key)) {
+				return false;
+			}
+		}
+		for(const auto& key : rules[skip].get) {
+			if(keys.count(key)) {
+				skip_url = true;
+			}
+		}
+	}
+	if(has_ext) {
+		std::string ext;
+		auto elems = b.segments();
+		if(!elems.empty()) {
+			std::string elem = elems.back();
+			auto pos = elem.find_last_of('.');
+			if(pos != std::string::npos) {
+				ext = elem.substr(pos + 1);
+			}
+		}
+		if(!ext.empty()) {
+			if(rules[exclude].ext.count(ext)) {
+				return false;
+			}
+			for(const auto& e : rules[include].ext) {
+				if(e != ext) {
+					return false;
+				}
+			}
+			if(rules[skip].ext.count(ext)) {
+				skip_url = true;
+			}
+		}
+	}
+	if(!skip_url) {
+		for(const auto& reg : rules[skip].reg) {
+			if(std::regex_search(first, last, reg)) {
+				skip_url = true;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+void Main::import_param(const std::string& file) {
+
+	namespace po = boost::program_options;
+
+	std::ifstream infile(file);
+	if(!infile.is_open()) {
+		throw std::runtime_error("Can not open setting file");
+	}
+
+	po::variables_map options;
+	po::options_description desc;
+
+	desc.add_options()
+		("main.subdomain", po::value<bool>(&param_subdomain))
+		("main.link_check", po::value<bool>(&link_check))
+		("main.thread", po::value<int>(&thread_cnt))
+		("main.url", po::value<std::string>(&param_url))
+		("main.sleep", po::value<int>(&param_sleep))
+		("main.host_limit", po::value<size_t>(&param_host_limit))
+		("main.try_limit", po::value<int>(&try_limit))
+		("main.recrawl_file", po::value<std::string>(&recrawl_file))
+		("main.checkpoint", po::value<std::string>(&checkpoint_file))
+		("main.checkpoint_interval", po::value<int>(&checkpoint_interval))
+		("main.retry_delay", po::value<int>(&retry_delay))
+		("main.retry_max", po::value<int>(&retry_max))
+		("main.url_limit", po::value<size_t>(&url_limit))
+		("main.redirect_limit", po::value<size_t>(&redirect_limit))
+		("main.cert_verification", po::value<bool>(&cert_verification))
+		("main.ca_cert_file_path", po::value<std::string>(&ca_cert_file_path))
+		("main.ca_cert_dir_path", po::value<std::string>(&ca_cert_dir_path))
+		("main.bind_interface", po::value<std::string>(&param_interface))
+		("main.keep_alive", po::value<bool>(&keep_alive))
+		("main.pool_host_limit", po::value<size_t>(&pool_host_limit))
+		("main.pool_idle_timeout", po::value<int>(&pool_idle_timeout))
+		("main.engine", po::value<std::string>(&engine))
+		("main.inflight", po::value<size_t>(&inflight))
+		("main.stream_parse", po::value<bool>(&stream_parse))
+		("main.seen_dir", po::value<std::string>(&seen_dir))
+		("main.seen_memory", po::value<size_t>(&seen_memory))
+		("main.seen_expected", po::value<size_t>(&seen_expected))
+		("main.compression", po::value<bool>(&compression))
+		("main.content_dedup", po::value<bool>(&content_dedup))
+		("main.dedup_memory", po::value<size_t>(&dedup_memory))
+		("main.dedup_distance", po::value<int>(&dedup_distance))
+		("filters.filter", po::value<std::vector<std::string>>())
+		("sitemap.enabled", po::value<bool>(&sitemap))
+		("sitemap.dir", po::value<std::string>(&sitemap_dir))
+		("sitemap.file_name", po::value<std::string>(&xml_name))
+		("sitemap.index_file_name", po::value<std::string>(&xml_index_name))
+		("sitemap.filemb_lim", po::value<int>(&xml_filemb_lim))
+		("sitemap.entry_lim", po::value<int>(&xml_entry_lim))
+		("sitemap.gzip", po::value<bool>(&xml_gzip))
+		("sitemap.gzip_threads", po::value<int>(&xml_gzip_threads))
+		("sitemap.lastmod", po::value<bool>(&xml_lastmod))
+		("sitemap.xml_tag", po::value<std::vector<std::string>>())
+		("log.type", po::value<std::string>())
+		("log.dir", po::value<std::string>(&log_dir))
+		("log.rewrite", po::value<bool>(&rewrite_log))
+		("log.max_log_cnt", po::value<int>(&max_log_cnt))
+		("log.csv_separator", po::value<std::string>(&csv_separator))
+		("log.async", po::value<bool>(&log_async))
+		("log.queue_size", po::value<size_t>(&log_queue_size))
+		("log.overflow", po::value<std::string>())
+		("log.info_db", po::value<std::string>(&info_db_file))
+		("log.log_redirect", po::value<bool>(&param_log_redirect))
+		("log.log_bad_html", po::value<bool>(&param_log_bad_html))
+		("log.log_bad_url", po::value<bool>(&param_log_bad_url))
+		("log.log_error_reply", po::value<bool>(&param_log_error_reply))
+		("log.log_ignored_url", po::value<bool>(&param_log_ignored_url))
+		("log.log_info", po::value<bool>(&param_log_info))
+		("log.log_other", po::value<bool>(&param_log_other))
+		("log.log_skipped_url", po::value<bool>(&param_log_skipped_url))
+	;
+	po::store(po::parse_config_file(infile, desc), options);
+	po::notify(options);
+
+	if(param_url.empty()) {
+		throw std::runtime_error("Parameter 'url' is empty");
+	}
+	boost::system::result<boost::urls::url> r = boost::urls::parse_uri_reference(param_url);
+	if(!r) {
+		throw std::runtime_error("Parameter 'url' is not valid");
+	}
+	uri = r.value();
+	uri_host = uri.host();
+
+	if(engine != "thread" && engine != "epoll") {
+		throw std::runtime_error("Parameter 'engine' (" + engine + ") is not valid");
+	}
+#ifndef LINUX_PLATFORM
+	if(engine == "epoll") {
+		throw std::runtime_error("Parameter 'engine' (epoll) is not supported on this platform");
+	}
+#endif
+	if(thread_cnt < 1) {
+		throw std::runtime_error("Parameter 'thread' is not valid");
+	}
+	if(param_sleep < 0) {
+		throw std::runtime_error("Parameter 'sleep' is not valid");
+	}
+	// the requests in flight of epoll would otherwise all go to the one host of a site
+	if(engine == "epoll" && !options.count("main.host_limit")) {
+		param_host_limit = 8;
+	}
+	if(retry_delay < 0) {
+		throw std::runtime_error("Parameter 'retry_delay' is not valid");
+	}
+	if(retry_max < 0) {
+		throw std::runtime_error("Parameter 'retry_max' is not valid");
+	}
+	if(resume && checkpoint_file.empty()) {
+		throw std::runtime_error("Parameter 'checkpoint' is empty");
+	}
+	url_unique.init(seen_dir, seen_memory, seen_expected);
+
+	if(options.count("filters.filter")) {
+		const auto& filters = options["filters.filter"].as<std::vector<std::string>>();
+		for(const auto& filter : filters) {
+			param_filter.add(filter);
+		}
+		param_filter.compile();
+	}
+
+	if(options.count("sitemap.xml_tag")) {
+		const auto& tags = options["sitemap.xml_tag"].as<std::vector<std::string>>();
+		std::unordered_map<std::string, size_t> patterns;
+		for(const auto& tag : tags) {
+			str_vec v;
+			boost::split(v, tag, boost::is_any_of(" "));
+			if(v.size() != 3) {
+				throw std::runtime_error("Parameter 'xml_tag' (" + tag + ") is not valid");
+			}
+			auto& xml_tag = param_xml_tag[v[0]];
+			if(v[2] == "default") {
+				xml_tag.def = XML_writer::escape_str(v[1]);
+				continue;
+			}
+			auto it = patterns.find(v[2]);
+			if(it == patterns.end()) {
+				try {
+					xml_tag_regex.emplace_back(v[2], std::regex_constants::ECMAScript | std::regex_constants::icase | std::regex_constants::optimize);
+				} catch(const std::regex_error&) {
+					throw std::runtime_error("Parameter 'xml_tag' (" + tag + ") is not valid");
+				}
+				it = patterns.emplace(v[2], xml_tag_regex.size() - 1).first;
+			}
+			xml_tag.rules.emplace_back(XML_writer::escape_str(v[1]), it->second);
+		}
+	}
+
+	if(options.count("log.type")) {
+		str_vec vec;
+		boost::split(vec, options["log.type"].as<std::string>(), boost::is_any_of(","));
+		std::set<std::string> param_type_log(vec.begin(), vec.end());
+		type_log = std::move(param_type_log);
+		if(type_log.find("csv") != type_log.end() || type_log.find("xml") != type_log.end()) {
+			if(log_dir.empty()) {
+				throw std::runtime_error("Parameter 'log.dir' is empty");
+			}
+		}
+	}
+	auto it = type_log.find("console");
+	if(it != type_log.end()) {
+		type_log.erase(it);
+		if(param_log_redirect) {
+			log_redirect_console.init({"console"}, "redirect", {Log::Field::url, Log::Field::parent});
+		}
+		if(param_log_error_reply) {
+			log_error_reply_console.init({"console"}, "error_reply", {Log::Field::msg, Log::Field::url, Log::Field::parent});
+		}
+		if(param_log_ignored_url) {
+			log_ignored_url_console.init({"console"}, "ignored_url", {Log::Field::found, Log::Field::parent});
+		}
+		if(param_log_skipped_url) {
+			log_skipped_url_console.init({"console"}, "skipped_url", {Log::Field::url, Log::Field::parent});
+		}
+		if(param_log_bad_html) {
+			log_bad_html_console.init({"console"}, "bad_html", {Log::Field::msg, Log::Field::url});
+		}
+		if(param_log_bad_url) {
+			log_bad_url_console.init({"console"}, "bad_url", {Log::Field::found, Log::Field::parent});
+		}
+		if(param_log_info) {
+			log_info_console.init({"console"}, "info", {Log::Field::thread, Log::Field::time, Log::Field::url, Log::Field::parent});
+		}
+	}
+	if(param_log_redirect) {
+		log_redirect_file.init(type_log, "redirect", {Log::Field::url, Log::Field::id_parent});
+	}
+	if(param_log_error_reply) {
+		log_error_reply_file.init(type_log, "error_reply", {Log::Field::msg, Log::Field::url, Log::Field::id_parent});
+	}
+	if(param_log_ignored_url) {
+		log_ignored_url_file.init(type_log, "ignored_url", {Log::Field::found, Log::Field::id_parent});
+	}
+	if(param_log_skipped_url) {
+		log_skipped_url_file.init(type_log, "skipped_url", {Log::Field::url, Log::Field::id_parent});
+	}
+	if(param_log_bad_html) {
+		log_bad_html_file.init(type_log, "bad_html", {Log::Field::msg, Log::Field::id});
+	}
+	if(param_log_bad_url) {
+		log_bad_url_file.init(type_log, "bad_url", {Log::Field::found, Log::Field::id_parent});
+	}
+	if(param_log_info) {
+		log_info_file.init(type_log, "info", {Log::Field::id, Log::Field::parent, Log::Field::time, Log::Field::try_cnt, Log::Field::cnt, Log::Field::is_html, Log::Field::found, Log::Field::url, Log::Field::charset, Log::Field::msg, Log::Field::duplicate});
+	}
+	if(param_log_other) {
+		log_other.init(type_log, "other", {Log::Field::msg});
+	}
+	if(options.count("log.overflow")) {
+		auto overflow = options["log.overflow"].as<std::string>();
+		if(overflow == "block") {
+			log_overflow = Log_queue::block;
+		} else if(overflow == "drop") {
+			log_overflow = Log_queue::drop;
+		} else if(overflow == "count") {
+			log_overflow = Log_queue::count;
+		} else {
+			throw std::runtime_error("Parameter 'log.overflow' (" + overflow + ") is not valid");
+		}
+	}
+	// unclosed tags can not be told apart from tags split between pieces
+	if(param_log_bad_html) {
+		stream_parse = false;
+	}
+	// the whole body is needed before parsing to skip duplicates
+	if(content_dedup) {
+		if(dedup_distance < 0 || dedup_distance > 3) {
+			throw std::runtime_error("Parameter 'dedup_distance' is not valid");
+		}
+		stream_parse = false;
+		content_index.init(dedup_memory, dedup_distance);
+	}
+	if(log_queue_size < 1) {
+		throw std::runtime_error("Parameter 'log.queue_size' is not valid");
+	}
+	if(log_async) {
+		log_queue.start(log_queue_size, log_overflow);
+	}
+	// urls of finished records are read by these later, by parent id
+	// for the console logs
+	keep_strings = !checkpoint_file.empty() || log_info_file || !info_db_file.empty() ||
+		log_redirect_console || log_error_reply_console || log_ignored_url_console || log_skipped_url_console ||
+		log_bad_html_console || log_bad_url_console || log_info_console;
+	if(sitemap) {
+		if(sitemap_dir.empty()) {
+			throw std::runtime_error("Parameter 'sitemap.dir' is empty");
+		}
+		// the protocol limit applies to the uncompressed file
+		if(xml_gzip && (xml_filemb_lim < 1 || xml_filemb_lim > 50)) {
+			throw std::runtime_error("Parameter 'sitemap.filemb_lim' is not valid");
+		}
+		if(xml_gzip_threads < 0) {
+			throw std::runtime_error("Parameter 'sitemap.gzip_threads' is not valid");
+		}
+		sitemap_sink.open();
+	}
+	if(!recrawl_file.empty()) {
+		recrawl.open(recrawl_file);
+	}
+}
+
+Gzip_pool::~Gzip_pool() {
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		stop = true;
+	}
+	cond.notify_all();
+	for(auto& t : threads) {
+		t.join();
+	}
+}
+
+void Gzip_pool::start(int cnt) {
+	limit = cnt;
+	for(int i = 0; i < cnt; i++) {
+		threads.emplace_back(&Gzip_pool::run, this);
+	}
+}
+
+// Blocks while every thread is busy and as many files are waiting.
+void Gzip_pool::add(const std::string& name, std::string&& data) {
+	std::unique_lock<std::mutex> lk(mutex);
+	if(!error.empty()) {
+		throw std::runtime_error(error);
+	}
+	cond_space.wait(lk, [this] {
+		return jobs.size() < limit;
+	});
+	jobs.emplace_back(name, std::move(data));
+	cond.notify_one();
+}
+
+void Gzip_pool::finish() {
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		stop = true;
+	}
+	cond.notify_all();
+	for(auto& t : threads) {
+		t.join();
+	}
+	threads.clear();
+	if(!error.empty()) {
+		throw std::runtime_error(error);
+	}
+}
+
+void Gzip_pool::run() {
+	while(true) {
+		std::pair<std::string, std::string> job;
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+			cond.wait(lk, [this] {
+				return stop || !jobs.empty();
+			});
+			if(jobs.empty()) {
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		cond_space.notify_one();
+		try {
+			compress(job.first, job.second);
+		} catch(std::exception& e) {
+			std::lock_guard<std::mutex> lk(mutex);
+			if(error.empty()) {
+				error = e.what();
+			}
+		}
+	}
+}
+
+void Gzip_pool::compress(const std::string& name, const std::string& data) {
+	std::ofstream file(name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + name);
+	}
+	z_stream z = {};
+	// 16 writes a gzip header
+	if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		throw std::runtime_error("Can not compress " + name);
+	}
+	std::vector<char> buf(utils::file_buffer_size);
+	z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	z.avail_in = static_cast<uInt>(data.size());
+	int ret;
+	do {
+		z.next_out = reinterpret_cast<Bytef*>(buf.data());
+		z.avail_out = static_cast<uInt>(buf.size());
+		ret = deflate(&z, Z_FINISH);
+		file.write(buf.data(), buf.size() - z.avail_out);
+	} while(ret == Z_OK);
+	uint64_t size = z.total_out;
+	deflateEnd(&z);
+	if(ret != Z_STREAM_END || !file) {
+		throw std::runtime_error("Can not write " + name);
+	}
+	in_bytes += data.size();
+	out_bytes += size;
+}
+
+void Sitemap_sink::open() {
+	std::ostringstream str;
+	XML_writer w(str);
+	w.write_start_doc();
+	w.write_start_el("urlset");
+	w.write_attr("xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
+	w.write_str("", false);
+	head = str.str();
+	tail = "\n</urlset>";
+	if(main_obj.xml_gzip) {
+		int threads = main_obj.xml_gzip_threads;
+		if(!threads) {
+			threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+		}
+		gzip.start(threads);
+	}
+	open_file();
+}
+
+std::string Sitemap_sink::file_name(int i) const {
+	return main_obj.xml_name + std::to_string(i) + (main_obj.xml_gzip ? ".xml.gz" : ".xml");
+}
+
+void Sitemap_sink::open_file() {
+	file_cnt++;
+	entry_cnt = 0;
+	pos = head.size();
+	if(main_obj.xml_gzip) {
+		shard.clear();
+		shard.reserve(static_cast<size_t>(main_obj.xml_filemb_lim) * 1024 * 1024);
+		shard += head;
+		return;
+	}
+	std::string name(main_obj.sitemap_dir + "/" + file_name(file_cnt));
+	buffer.resize(utils::file_buffer_size);
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	file.open(name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + name);
+	}
+	file.write(head.data(), head.size());
+}
+
+void Sitemap_sink::close_file() {
+	if(main_obj.xml_gzip) {
+		shard += tail;
+		gzip.add(main_obj.sitemap_dir + "/" + file_name(file_cnt), std::move(shard));
+		shard = std::string();
+		return;
+	}
+	file.write(tail.data(), tail.size());
+	file.close();
+}
+
+// Appends one <url> element in the layout XML_writer uses for the file.
+void Sitemap_sink::render(const Url_struct* url, std::string& out) {
+	// the last matching rule wins so rules are checked from the end,
+	// each regex runs at most once
+	const std::string& resolved = url->resolved;
+	auto tag = [&out](const std::string& name, const std::string& value) {
+		out += "\n\t\t<";
+		out += name;
+		out += '>';
+		out += value;
+		out += "</";
+		out += name;
+		out += '>';
+	};
+	out += "\n\t<url>";
+	tag("loc", XML_writer::escape_str(resolved));
+	if(url->lastmod && main_obj.xml_lastmod && !main_obj.param_xml_tag.count("lastmod")) {
+		tag("lastmod", utils::w3c_date(url->lastmod));
+	}
+	// results per regex, -1 while not run
+	thread_local std::vector<int8_t> matched;
+	matched.assign(main_obj.xml_tag_regex.size(), -1);
+	for(auto it1 = main_obj.param_xml_tag.begin(); it1 != main_obj.param_xml_tag.end(); ++it1) {
+		const std::string* value = &it1->second.def;
+		for(auto it2 = it1->second.rules.rbegin(); it2 != it1->second.rules.rend(); ++it2) {
+			auto& m = matched[it2->second];
+			if(m < 0) {
+				m = std::regex_search(resolved, main_obj.xml_tag_regex[it2->second]);
+			}
+			if(m) {
+				value = &it2->first;
+				break;
+			}
+		}
+		tag(it1->first, *value);
+	}
+	out += "\n\t</url>";
+	entries++;
+}
+
+// Called under the lock with one rendered entry.
+void Sitemap_sink::write(const char* data, size_t size) {
+	uint64_t limit = static_cast<uint64_t>(main_obj.xml_filemb_lim) * 1024 * 1024;
+	if(entry_cnt && (entry_cnt >= main_obj.xml_entry_lim || pos + size + tail.size() > limit)) {
+		close_file();
+		open_file();
+	}
+	if(main_obj.xml_gzip) {
+		shard.append(data, size);
+	} else {
+		file.write(data, size);
+	}
+	pos += size;
+	entry_cnt++;
+}
+
+void Sitemap_sink::add(const Url_struct* url) {
+	thread_local std::string entry;
+	entry.clear();
+	render(url, entry);
+	std::lock_guard<std::mutex> lk(mutex);
+	write(entry.data(), entry.size());
+}
+
+// Urls are cut into fixed shards rendered in parallel, the shards are
+// written in order so the output does not depend on the thread count.
+void Sitemap_sink::add(const std::vector<const Url_struct*>& urls) {
+	const size_t shard_size = 16384;
+	struct Shard {
+		std::string data;
+		std::vector<uint32_t> sizes;
+	};
+	size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	size_t shard_cnt = (urls.size() + shard_size - 1) / shard_size;
+	std::vector<Shard> shards(std::min(threads, shard_cnt));
+	for(size_t first = 0; first < shard_cnt; first += shards.size()) {
+		size_t cnt = std::min(shards.size(), shard_cnt - first);
+		std::atomic<size_t> next{0};
+		auto work = [&] {
+			for(size_t i = next++; i < cnt; i = next++) {
+				auto& s = shards[i];
+				s.data.clear();
+				s.sizes.clear();
+				size_t begin = (first + i) * shard_size;
+				size_t end = std::min(begin + shard_size, urls.size());
+				for(size_t j = begin; j < end; j++) {
+					size_t before = s.data.size();
+					render(urls[j], s.data);
+					s.sizes.push_back(static_cast<uint32_t>(s.data.size() - before));
+				}
+			}
+		};
+		std::vector<std::thread> pool;
+		for(size_t i = 1; i < cnt; i++) {
+			pool.emplace_back(work);
+		}
+		work();
+		for(auto& t : pool) {
+			t.join();
+		}
+		std::lock_guard<std::mutex> lk(mutex);
+		for(size_t i = 0; i < cnt; i++) {
+			const char* p = shards[i].data.data();
+			for(auto size : shards[i].sizes) {
+				write(p, size);
+				p += size;
+			}
+		}
+	}
+}
+
+std::string Sitemap_sink::stats() const {
+	if(!entries) {
+		return "";
+	}
+	std::stringstream str;
+	str << std::fixed << std::setprecision(2);
+	str << "Sitemap: " << entries << " urls in " << file_cnt << " files";
+	if(gzip.get_in()) {
+		str << ", gzip " << static_cast<double>(gzip.get_in()) / (1024 * 1024) << " MB to " << static_cast<double>(gzip.get_out()) / (1024 * 1024) << " MB";
+	}
+	return str.str();
+}
+
+void Sitemap_sink::close() {
+	if(!file_cnt) {
+		return;
+	}
+	close_file();
+	gzip.finish();
+	if(main_obj.xml_index_name.empty()) {
+		return;
+	}
+	auto base = main_obj.uri.scheme().data() + std::string("://") + main_obj.uri.authority().data();
+	std::string name(main_obj.sitemap_dir + "/" + main_obj.xml_index_name + ".xml");
+	file.open(name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + name);
+	}
+	writer.write_start_doc();
+	writer.write_start_el("sitemapindex");
+	writer.write_attr("xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
+	writer.write_start_el("sitemap");
+	for(int i = 1; i <= file_cnt; i++) {
+		writer.write_start_el("loc");
+		writer.write_str(base + file_name(i));
+		writer.write_end_el();
+	}
+	writer.write_end_el();
+	writer.write_end_el();
+	writer.write_end_doc();
+	writer.flush();
+	file.close();
+}
+
+// The url is normalized in thread local buffers, query parameters are sorted
+// by reference, only the 128-bit hash of the result is kept.
+Fingerprint Main::url_fingerprint(const boost::url& url) {
+	thread_local boost::url u;
+	thread_local std::string out;
+	thread_local std::vector<std::pair<const char*, size_t>> params;
+	u = url;
+	u.normalize();
+	u.remove_fragment();
+	if(u.port() == "80" || u.port().empty()) {
+		u.remove_port();
+	}
+	if(u.has_authority() && u.encoded_path().empty()) {
+		u.set_path_absolute(true);
+	}
+	auto buf = u.buffer();
+	out.assign(buf.data(), buf.size());
+	if(u.has_query()) {
+		// the query is at the end as the fragment is removed
+		auto query = u.encoded_query();
+		out.resize(out.size() - query.size());
+		params.clear();
+		const char* p = query.data();
+		const char* end = p + query.size();
+		while(true) {
+			auto amp = static_cast<const char*>(std::memchr(p, '&', end - p));
+			if(!amp) {
+				amp = end;
+			}
+			params.emplace_back(p, amp - p);
+			if(amp == end) {
+				break;
+			}
+			p = amp + 1;
+		}
+		std::sort(params.begin(), params.end(), [](const std::pair<const char*, size_t>& a, const std::pair<const char*, size_t>& b) {
+			int r = std::memcmp(a.first, b.first, std::min(a.second, b.second));
+			return r < 0 || (!r && a.second < b.second);
+		});
+		for(size_t i = 0; i < params.size(); i++) {
+			if(i) {
+				out += '&';
+			}
+			out.append(params[i].first, params[i].second);
+		}
+	}
+	return utils::hash128(out.data(), out.size());
+}
+
+str_vec Main::summary() {
+	str_vec ret;
+	size_t cnt_new = client_pool.get_cnt_new();
+	size_t cnt_reuse = client_pool.get_cnt_reuse();
+	if(cnt_new + cnt_reuse) {
+		std::stringstream str;
+		str << std::fixed << std::setprecision(2);
+		str << "Connections: " << cnt_new << " new, " << cnt_reuse << " reused (" << 100.0 * cnt_reuse / (cnt_new + cnt_reuse) << "%)";
+		ret.push_back(str.str());
+	}
+	if(url_all.size()) {
+		size_t mem = url_all.mem_size() + url_strings.mem_size() + hosts.mem_size() + charsets.mem_size() + errors.mem_size();
+		mem += url_unique.mem_size();
+		std::stringstream str;
+		str << std::fixed << std::setprecision(1);
+		str << "URL store: " << url_all.size() << " urls, " << static_cast<double>(mem) / url_all.size() << " bytes per url";
+		ret.push_back(str.str());
+	}
+	auto seen = url_unique.stats();
+	if(!seen.empty()) {
+		ret.push_back(seen);
+	}
+	if(log_overflow == Log_queue::count && log_queue.get_dropped()) {
+		ret.push_back("Log queue: " + std::to_string(log_queue.get_dropped()) + " messages dropped");
+	}
+	auto sitemap_stats = sitemap_sink.stats();
+	if(!sitemap_stats.empty()) {
+		ret.push_back(sitemap_stats);
+	}
+	auto dedup_stats = content_index.stats();
+	if(!dedup_stats.empty()) {
+		ret.push_back(dedup_stats);
+	}
+	auto recrawl_stats = recrawl.stats();
+	if(!recrawl_stats.empty()) {
+		ret.push_back(recrawl_stats);
+	}
+	for(const auto& str : transfer.summary(hosts)) {
+		ret.push_back(str);
+	}
+	return ret;
+}
+
+bool Main::exit_handler() {
+	std::cout << "Stopping..." << std::endl;
+	interrupted = true;
+	running = false;
+	wake(true);
+	return true;
+}
+
+void Main::start() {
+	Url_new url;
+	url.found = param_url;
+	url.handle = url_handle_t::query_parse;
+	Url_base base;
+	base.set(param_url);
+	if(!handle_url(url, base, false)) {
+		throw std::runtime_error("Parameter 'url' is not valid");
+	}
+	frontier.init(thread_cnt, param_sleep, param_host_limit);
+	if(resume) {
+		load_checkpoint();
+	} else {
+		set_url(url);
+	}
+
+	if(!sys::handle_exit()) {
+		std::cout << "Could not set exit handler" << std::endl;
+	}
+
+	if(!checkpoint_file.empty() && checkpoint_interval > 0) {
+		checkpoint_thread = std::thread(&Main::checkpoint_loop, this);
+	}
+	run_workers();
+	if(checkpoint_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lk(mutex_checkpoint);
+			checkpoint_stop = true;
+		}
+		cond_checkpoint.notify_all();
+		checkpoint_thread.join();
+	}
+	// a finished crawl has nothing to resume
+	if(!checkpoint_file.empty()) {
+		if(interrupted || exc_ptr) {
+			save_checkpoint();
+		} else {
+			std::remove(checkpoint_file.c_str());
+		}
+	}
+}
+
+void Main::run_workers() {
+#ifdef LINUX_PLATFORM
+	if(engine == "epoll") {
+		std::vector<std::unique_ptr<Fetch_engine>> engines;
+		engines.reserve(thread_cnt);
+		for(int i = 0; i < thread_cnt; i++) {
+			engines.emplace_back(new Fetch_engine(i + 1, (inflight + thread_cnt - 1) / thread_cnt));
+			engines[i]->start();
+		}
+		for(auto& engine : engines) {
+			engine->join();
+		}
+		return;
+	}
+#endif
+	std::vector<Thread> threads;
+	threads.reserve(thread_cnt);
+	for(int i = 0; i < thread_cnt; i++) {
+		threads.emplace_back(i + 1);
+		threads[i].start();
+	}
+	for(auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void Main::checkpoint_loop() {
+	std::unique_lock<std::mutex> lk(mutex_checkpoint);
+	while(!cond_checkpoint.wait_for(lk, std::chrono::seconds(checkpoint_interval), [this] {
+		return checkpoint_stop;
+	})) {
+		lk.unlock();
+		try {
+			save_checkpoint();
+		} catch(const std::exception& e) {
+			std::cout << e.what() << std::endl;
+			if(log_other) {
+				log_other.write({e.what()});
+			}
+		}
+		lk.lock();
+	}
+}
+
+// Only the record count and the seen set are taken under the lock. Published
+// records and their strings do not change, they are streamed from the store
+// to a temporary file which replaces the checkpoint only when complete.
+void Main::save_checkpoint() {
+	size_t rec_cnt;
+	std::unique_ptr<Seen_snapshot> seen;
+	// done flags are read with the count, a page done later may have
+	// outlinks past rec_cnt and is saved as pending
+	std::vector<uint8_t> done;
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		rec_cnt = url_all.size();
+		done.resize(rec_cnt);
+		for(size_t i = 0; i < rec_cnt; i++) {
+			done[i] = url_all[i]->done.load(std::memory_order_acquire);
+		}
+		seen.reset(new Seen_snapshot(url_unique.snapshot()));
+	}
+	std::string tmp_name = checkpoint_file + ".tmp";
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(tmp_name.c_str(), "wb"), &std::fclose);
+	if(!file) {
+		throw std::runtime_error("Can not open " + tmp_name);
+	}
+	bool ok = true;
+	std::string buf;
+	auto flush = [&](bool force) {
+		if(force || buf.size() >= (1 << 20)) {
+			ok = ok && std::fwrite(buf.data(), 1, buf.size(), file.get()) == buf.size();
+			buf.clear();
+		}
+	};
+	Checkpoint_head head;
+	std::memset(&head, 0, sizeof(head));
+	std::memcpy(head.magic, "SMCKPT3", 8);
+	head.rec_cnt = rec_cnt;
+	// written again when the sizes are known
+	buf.append(reinterpret_cast<const char*>(&head), sizeof(head));
+	uint64_t blob_size = 0;
+	for(size_t i = 0; i < rec_cnt; i++) {
+		auto url = url_all[i];
+		Checkpoint_rec rec;
+		std::memset(&rec, 0, sizeof(rec));
+		rec.resolved_pos = blob_size;
+		rec.resolved_size = url->resolved.size;
+		blob_size += url->resolved.size;
+		rec.found_pos = blob_size;
+		rec.found_size = url->found.size;
+		blob_size += url->found.size;
+		rec.path_pos = url->path_pos;
+		rec.path_len = url->path_len;
+		rec.host = url->host;
+		rec.parent = url->parent;
+		rec.try_cnt = url->try_cnt;
+		rec.cnt = url->cnt;
+		rec.redirect_cnt = url->redirect_cnt;
+		rec.ssl = url->ssl;
+		rec.handle = static_cast<uint8_t>(url->handle);
+		// results of a request in progress are not stable yet
+		if(done[i]) {
+			rec.done = 1;
+			rec.charset = url->charset;
+			rec.error = url->error;
+			rec.time = url->time;
+			rec.lastmod = url->lastmod;
+			rec.duplicate = url->duplicate;
+			rec.is_html = url->is_html;
+		}
+		buf.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+		flush(false);
+	}
+	for(size_t i = 0; i < rec_cnt; i++) {
+		auto url = url_all[i];
+		buf.append(url->resolved.data, url->resolved.size);
+		buf.append(url->found.data, url->found.size);
+		flush(false);
+	}
+	head.blob_size = blob_size;
+	size_t table_start = buf.size();
+	uint64_t table_size = 0;
+	for(auto table : {&hosts, &charsets, &errors}) {
+		uint32_t n = static_cast<uint32_t>(table->size());
+		buf.append(reinterpret_cast<const char*>(&n), sizeof(n));
+		for(uint32_t i = 0; i < n; i++) {
+			auto str = table->get(i);
+			uint32_t len = static_cast<uint32_t>(str.size());
+			buf.append(reinterpret_cast<const char*>(&len), sizeof(len));
+			buf += str;
+		}
+		table_size += buf.size() - table_start;
+		flush(false);
+		table_start = buf.size();
+	}
+	head.table_size = table_size;
+	uint64_t seen_size = 0;
+	seen->each([&](const Seen_slot& slot) {
+		// added after the record count was taken
+		if(slot.id > rec_cnt) {
+			return;
+		}
+		buf.append(reinterpret_cast<const char*>(&slot), sizeof(slot));
+		seen_size += sizeof(slot);
+		flush(false);
+	});
+	seen.reset();
+	head.seen_size = seen_size;
+	flush(true);
+	ok = ok && !std::fseek(file.get(), 0, SEEK_SET) && std::fwrite(&head, sizeof(head), 1, file.get()) == 1;
+	ok = ok && !std::fflush(file.get());
+#ifdef WINDOWS_PLATFORM
+	ok = ok && !_commit(_fileno(file.get()));
+#else
+	ok = ok && !fsync(fileno(file.get()));
+#endif
+	ok = !std::fclose(file.release()) && ok;
+	if(!ok) {
+		throw std::runtime_error("Can not write " + tmp_name);
+	}
+	if(std::rename(tmp_name.c_str(), checkpoint_file.c_str())) {
+		throw std::runtime_error("Can not rename " + tmp_name);
+	}
+}
+
+// Restores the records and the seen set, sitemap entries are written again
+// and urls without a final result go to the frontier.
+void Main::load_checkpoint() {
+	File_map data(checkpoint_file);
+	auto invalid = std::runtime_error("Checkpoint " + checkpoint_file + " is not valid");
+	Checkpoint_head head;
+	if(data.size() < sizeof(head)) {
+		throw invalid;
+	}
+	std::memcpy(&head, data.data(), sizeof(head));
+	if(std::memcmp(head.magic, "SMCKPT3", 8) || head.rec_cnt > INT32_MAX || head.blob_size > data.size() || head.table_size > data.size() || head.seen_size > data.size()) {
+		throw invalid;
+	}
+	size_t rec_pos = sizeof(head);
+	size_t blob_pos = rec_pos + head.rec_cnt * sizeof(Checkpoint_rec);
+	size_t table_pos = blob_pos + head.blob_size;
+	size_t seen_pos = table_pos + head.table_size;
+	if(data.size() != seen_pos + head.seen_size) {
+		throw invalid;
+	}
+	const char* p = data.data() + table_pos;
+	const char* table_end = p + head.table_size;
+	auto read_size = [&](uint32_t& v) {
+		if(table_end - p < static_cast<std::ptrdiff_t>(sizeof(v))) {
+			throw invalid;
+		}
+		std::memcpy(&v, p, sizeof(v));
+		p += sizeof(v);
+	};
+	for(auto table : {&hosts, &charsets, &errors}) {
+		uint32_t n;
+		read_size(n);
+		for(uint32_t i = 0; i < n; i++) {
+			uint32_t len;
+			read_size(len);
+			if(static_cast<size_t>(table_end - p) < len || table->add(std::string(p, len)) != i) {
+				throw invalid;
+			}
+			p += len;
+		}
+	}
+	std::unique_lock<std::mutex> lk(mutex);
+	const char* blob = data.data() + blob_pos;
+	// checked without overflow, the path is a part of the resolved url
+	auto in_blob = [&head](uint64_t pos, uint64_t size) {
+		return pos <= head.blob_size && size <= head.blob_size - pos;
+	};
+	for(size_t i = 0; i < head.rec_cnt; i++) {
+		Checkpoint_rec rec;
+		std::memcpy(&rec, data.data() + rec_pos + i * sizeof(rec), sizeof(rec));
+		if(!in_blob(rec.resolved_pos, rec.resolved_size) || !in_blob(rec.found_pos, rec.found_size) || rec.path_pos > rec.resolved_size || rec.path_len > rec.resolved_size - rec.path_pos || rec.handle > static_cast<uint8_t>(url_handle_t::none)) {
+			throw invalid;
+		}
+		auto url = url_all.add();
+		url->id = static_cast<int>(i + 1);
+		url->resolved = url_strings.add(std::string(blob + rec.resolved_pos, rec.resolved_size));
+		if(rec.found_size) {
+			url->found = url_strings.add(std::string(blob + rec.found_pos, rec.found_size));
+		}
+		url->path_pos = rec.path_pos;
+		url->path_len = rec.path_len;
+		url->host = rec.host;
+		url->charset = rec.charset;
+		url->error = rec.error;
+		url->parent = rec.parent;
+		url->try_cnt = rec.try_cnt;
+		url->cnt = rec.cnt;
+		url->time = rec.time;
+		url->lastmod = rec.lastmod;
+		url->duplicate = rec.duplicate;
+		url->redirect_cnt = rec.redirect_cnt;
+		url->is_html = rec.is_html != 0;
+		url->ssl = rec.ssl != 0;
+		url->handle = static_cast<url_handle_t>(rec.handle);
+		url->done = rec.done != 0;
+	}
+	url_all.publish();
+	if(!url_unique.load(data.data() + seen_pos, head.seen_size)) {
+		throw invalid;
+	}
+	lk.unlock();
+	size_t pending = 0;
+	std::vector<const Url_struct*> listed;
+	for(size_t i = 0; i < url_all.size(); i++) {
+		auto url = url_all[i];
+		if(url->handle == url_handle_t::none || (url->done && url->is_html && !url->duplicate && !url->error)) {
+			if(sitemap) {
+				listed.push_back(url);
+			}
+		}
+		if(url->handle != url_handle_t::none && !url->done) {
+			frontier.push(url, -1);
+			pending++;
+		}
+	}
+	if(!listed.empty()) {
+		sitemap_sink.add(listed);
+	}
+	std::cout << "Resumed " << url_all.size() << " urls, " << pending << " pending" << std::endl;
+}
+
+bool Main::set_url(Url_new& url, int worker) {
+	std::unique_lock<std::mutex> lk(mutex);
+	if(url_limit && url_all.size() >= url_limit) {
+		if(!url_lim_reached) {
+			if(log_other) {
+				log_other.write({"URL limit reached"});
+			}
+			url_lim_reached = true;
+		}
+		return false;
+	}
+	uint32_t idx;
+	if(url_unique.find(url.fingerprint, idx)) {
+		url_all[idx]->cnt++;
+		return false;
+	}
+	auto rec = url_all.add();
+	rec->id = static_cast<int>(url_all.size() + 1);
+	rec->resolved = url_strings.add(url.resolved);
+	url_unique.add(url.fingerprint, rec->id - 1);
+	if(log_info_file || !info_db_file.empty()) {
+		rec->found = url_strings.add(url.found);
+	}
+	rec->path_pos = static_cast<uint32_t>(url.path_pos);
+	rec->path_len = static_cast<uint32_t>(url.path_len);
+	rec->host = hosts.add(url.host);
+	rec->ssl = url.ssl;
+	rec->parent = url.parent;
+	rec->redirect_cnt = static_cast<uint8_t>(std::min<size_t>(url.redirect_cnt, UINT8_MAX));
+	rec->handle = url.handle;
+	url_all.publish();
+	if(rec->handle == url_handle_t::none) {
+		if(log_skipped_url_file) {
+			log_skipped_url_file.write({url.resolved, std::to_string(url.parent)});
+		}
+		if(log_skipped_url_console) {
+			log_skipped_url_console.write({url.resolved, get_resolved(url.parent)});
+		}
+		lk.unlock();
+		if(sitemap) {
+			sitemap_sink.add(rec);
+		}
+		if(!keep_strings) {
+			lk.lock();
+			url_strings.release(rec->resolved);
+		}
+		return true;
+	}
+	lk.unlock();
+	frontier.push(rec, worker);
+	wake();
+	return true;
+}
+
+// Exponential backoff with equal jitter unless the server gave a delay.
+void Main::try_again(Url_struct* url, int worker, int delay) {
+	if(delay < 0) {
+		static thread_local std::mt19937 gen(std::random_device{}());
+		int64_t d = static_cast<int64_t>(retry_delay) << std::min(std::max(url->try_cnt - 1, 0), 20);
+		d = std::min<int64_t>(d, retry_max);
+		delay = static_cast<int>(d / 2 + std::uniform_int_distribution<int64_t>(0, d - d / 2)(gen));
+	}
+	retries.push(url, worker, std::chrono::milliseconds(std::min(delay, retry_max)));
+	// sleepers may wait for a later due time
+	wake();
+}
+
+// Strings of a finished url are released when nothing reads them later.
+void Main::release_url(Url_struct* url) {
+	frontier.release(url);
+	if(!keep_strings && url->done.load(std::memory_order_acquire)) {
+		std::lock_guard<std::mutex> lk(mutex);
+		url_strings.release(url->resolved);
+		url_strings.release(url->found);
+	}
+	// the host may be eligible again or due earlier than sleepers wait for
+	wake();
+}
+
+void Main::wake(bool all) {
+	// frontier counter and sleepers are both seq_cst, so either the sleeper
+	// sees the new url or we see the sleeper
+	if(!all && !sleepers.load()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(mutex_idle);
+	}
+	if(all) {
+		cond.notify_all();
+	} else {
+		cond.notify_one();
+	}
+}
+
+bool Main::get_url(Thread* t) {
+	while(true) {
+		if(!running) {
+			if(!t->suspend) {
+				t->suspend = true;
+				thread_work--;
+			}
+			return false;
+		}
+		// count as working before taking a url, so that idle threads never
+		// see an empty frontier while a url is in transit
+		if(t->suspend) {
+			t->suspend = false;
+			std::lock_guard<std::mutex> lk(mutex_idle);
+			thread_work++;
+		}
+		if(retries.move_due(frontier)) {
+			wake();
+		}
+		t->m_url = frontier.pop(t->worker());
+		if(t->m_url) {
+			return true;
+		}
+		t->suspend = true;
+		if(--thread_work == 0) {
+			// idle threads resume work only under mutex_idle, so with no one
+			// working nothing moves between the queues or holds a url
+			bool finished;
+			{
+				std::lock_guard<std::mutex> lk(mutex_idle);
+				finished = !thread_work && frontier.empty() && retries.empty();
+			}
+			if(finished) {
+				running = false;
+				wake(true);
+				return false;
+			}
+		}
+		sleepers++;
+		{
+			// urls of hosts that are not eligible yet and retries are
+			// waited for until the earliest is due
+			auto due = std::min(frontier.next_due(), retries.next_due());
+			std::unique_lock<std::mutex> lk(mutex_idle);
+			// a retry or host due earlier than waited for ends the wait,
+			// the due time is computed again
+			auto ready = [this, due] {
+				return !running || frontier.ready() || std::min(frontier.next_due(), retries.next_due()) < due;
+			};
+			if(due == Frontier::clock_::time_point::max()) {
+				cond.wait(lk, ready);
+			} else {
+				cond.wait_until(lk, due, ready);
+			}
+		}
+		sleepers--;
+	}
+}
+
+bool Main::poll_url(Thread* t) {
+	t->m_url = nullptr;
+	if(!running) {
+		return false;
+	}
+	if(t->suspend) {
+		t->suspend = false;
+		std::lock_guard<std::mutex> lk(mutex_idle);
+		thread_work++;
+	}
+	retries.move_due(frontier);
+	t->m_url = frontier.pop(t->worker());
+	return true;
+}
+
+void Main::set_exception(std::exception_ptr e) {
+	{
+		std::lock_guard<std::mutex> lk(mutex_idle);
+		exc_ptr = e;
+	}
+	running = false;
+	wake(true);
+}
+
+std::string Main::get_resolved(int i) {
+	// records are never moved and resolved does not change once published,
+	// it is released only when no console log reads it
+	if(i <= 0 || static_cast<size_t>(i) > url_all.size()) {
+		return "";
+	}
+	return url_all[i - 1]->resolved;
+}
+
+void Url_base::set(const std::string& str) {
+	href = str;
+	auto r = boost::urls::parse_uri_reference(href);
+	ok = static_cast<bool>(r);
+	if(ok) {
+		parsed = *r;
+	}
+}
+
+bool Main::handle_url(Url_new& url_new, Url_base& base, bool filter) {
+	// trim whitespace
+	auto is_space = [](char ch) {
+		return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v';
+	};
+	const char* first = url_new.found.data();
+	const char* last = first + url_new.found.size();
+	while(first < last && is_space(*first)) {
+		first++;
+	}
+	while(last > first && is_space(*(last - 1))) {
+		last--;
+	}
+
+	// ----- resolve
+	auto rd = boost::urls::parse_uri_reference(boost::core::string_view(first, last - first));
+	if(!base.valid()) {
+		if(log_bad_url_file) {
+			log_bad_url_file.write({base.str(), std::to_string(url_new.parent)});
+		}
+		if(log_bad_url_console) {
+			log_bad_url_console.write({base.str(), get_resolved(url_new.parent)});
+		}
+	}
+	if(!rd) {
+		if(log_bad_url_file) {
+			log_bad_url_file.write({url_new.found, std::to_string(url_new.parent)});
+		}
+		if(log_bad_url_console) {
+			log_bad_url_console.write({url_new.found, get_resolved(url_new.parent)});
+		}
+		return false;
+	}
+	if(!base.valid()) {
+		return false;
+	}
+	auto& b = base.scratch;
+	if(!boost::urls::resolve(base.url(), *rd, b)) {
+		return false;
+	}
+
+	// ----- base filter
+	if(!b.scheme().starts_with("http")) {
+		return false;
+	}
+	auto d_host = rd->host();
+	auto& b_host = uri_host;
+	if(d_host.empty()) {
+		return false;
+	}
+	std::size_t i = d_host.find(b_host);
+	if(i == std::string::npos || i != d_host.size() - b_host.size()) {
+		return false;
+	}
+
+	// ----- user filter
+	if(filter) {
+		if(!param_subdomain && d_host != b_host) {
+			return false;
+		}
+		bool skip = false;
+		if(!param_filter.check(b, skip)) {
+			return false;
+		}
+		if(skip && url_new.handle == url_handle_t::query_parse) {
+			url_new.handle = url_handle_t::none;
+		}
+	}
+	url_new.resolved = b.buffer();
+	url_new.fingerprint = url_fingerprint(b);
+	url_new.ssl = b.scheme() == "https";
+	url_new.host = b.host();
+	// request target is the part of resolved between authority and fragment
+	size_t end = url_new.resolved.size();
+	if(b.has_fragment()) {
+		end -= b.encoded_fragment().size() + 1;
+	}
+	url_new.path_len = b.encoded_path().size();
+	if(b.has_query()) {
+		url_new.path_len += b.encoded_query().size() + 1;
+	}
+	url_new.path_pos = end - url_new.path_len;
+	return true;
+}
+
+void Main::finished() {
+	if(log_info_file) {
+		for(size_t i = 0; i < url_all.size(); i++) {
+			auto url = url_all[i];
+			log_info_file.write({
+				std::to_string(url->id),
+				std::to_string(url->parent),
+				std::to_string(url->time),
+				std::to_string(url->try_cnt),
+				std::to_string(url->cnt),
+				std::to_string(url->is_html),
+				url->found,
+				url->resolved,
+				charsets.get(url->charset),
+				errors.get(url->error),
+				std::to_string(url->duplicate)
+			});
+		}
+	}
+	if(!info_db_file.empty()) {
+		write_info_db();
+	}
+	if(sitemap) {
+		sitemap_sink.close();
+	}
+	recrawl.close(!interrupted);
+	// write what is left in the log queue, later messages are written directly
+	log_queue.stop();
+}
+
+void Main::write_info_db() {
+	size_t rows = url_all.size();
+	Info_db_writer db;
+	db.open(info_db_file);
+	db.column<int32_t>(info_db::id, rows, [this](size_t i) {
+		return url_all[i]->id;
+	});
+	db.column<int32_t>(info_db::parent, rows, [this](size_t i) {
+		return url_all[i]->parent;
+	});
+	db.column<double>(info_db::time, rows, [this](size_t i) {
+		return url_all[i]->time;
+	});
+	db.column<int32_t>(info_db::try_cnt, rows, [this](size_t i) {
+		return url_all[i]->try_cnt.load();
+	});
+	db.column<int32_t>(info_db::cnt, rows, [this](size_t i) {
+		return url_all[i]->cnt.load();
+	});
+	db.column<uint8_t>(info_db::is_html, rows, [this](size_t i) {
+		return url_all[i]->is_html;
+	});
+	db.column<int32_t>(info_db::duplicate, rows, [this](size_t i) {
+		return url_all[i]->duplicate;
+	});
+	db.column<uint32_t>(info_db::charset, rows, [this](size_t i) {
+		return url_all[i]->charset;
+	});
+	db.column<uint32_t>(info_db::msg, rows, [this](size_t i) {
+		return url_all[i]->error;
+	});
+	db.strings(info_db::found_offset, rows, [this](size_t i) {
+		return url_all[i]->found;
+	});
+	db.strings(info_db::url_offset, rows, [this](size_t i) {
+		return url_all[i]->resolved;
+	});
+	auto table = [&db](info_db::column_t c, const String_table& t) {
+		str_vec items;
+		for(uint32_t i = 0; i < t.size(); i++) {
+			items.push_back(t.get(i));
+		}
+		db.strings(c, items.size(), [&items](size_t i) {
+			Arena_str s;
+			s.data = items[i].data();
+			s.size = static_cast<uint32_t>(items[i].size());
+			return s;
+		});
+		return items.size();
+	};
+	size_t charset_cnt = table(info_db::charset_offset, charsets);
+	size_t msg_cnt = table(info_db::msg_offset, errors);
+	db.close(rows, charset_cnt, msg_cnt);
+}
+
+void Info_db_writer::open(const std::string& name) {
+	file_name = name;
+	buffer.resize(utils::file_buffer_size);
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	file.open(file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + file_name);
+	}
+	std::memset(&head, 0, sizeof(head));
+	std::memcpy(head.magic, info_db::magic, sizeof(head.magic));
+	put(&head, sizeof(head));
+}
+
+void Info_db_writer::begin(info_db::column_t c) {
+	static const char zero[8] = {};
+	put(zero, (8 - pos % 8) % 8);
+	head.columns[c].offset = pos;
+}
+
+void Info_db_writer::end(info_db::column_t c) {
+	head.columns[c].size = pos - head.columns[c].offset;
+}
+
+template<typename T, typename F>
+void Info_db_writer::column(info_db::column_t c, size_t rows, F get) {
+	begin(c);
+	for(size_t i = 0; i < rows; i++) {
+		T value = static_cast<T>(get(i));
+		put(&value, sizeof(value));
+	}
+	end(c);
+}
+
+// Offsets column c is followed by its heap column c + 1.
+void Info_db_writer::strings(info_db::column_t c, size_t cnt, const std::function<Arena_str(size_t)>& get) {
+	uint64_t offset = 0;
+	begin(c);
+	put(&offset, sizeof(offset));
+	for(size_t i = 0; i < cnt; i++) {
+		offset += get(i).size;
+		put(&offset, sizeof(offset));
+	}
+	end(c);
+	auto heap = static_cast<info_db::column_t>(c + 1);
+	begin(heap);
+	for(size_t i = 0; i < cnt; i++) {
+		auto s = get(i);
+		put(s.data, s.size);
+	}
+	end(heap);
+}
+
+void Info_db_writer::close(uint64_t rows, uint64_t charset_cnt, uint64_t msg_cnt) {
+	head.rows = rows;
+	head.charset_cnt = charset_cnt;
+	head.msg_cnt = msg_cnt;
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&head), sizeof(head));
+	file.close();
+	if(!file) {
+		throw std::runtime_error("Can not write " + file_name);
+	}
+}
+
+// Only the first entry of a name counts, as tags in Tags_main take precedence
+// over Tags_other and the first matching entry of Tags_other is used.
+Tag_table::Tag_table(const std::vector<std::string>& tags_main, const std::vector<Tag>& tags_other) {
+	auto add = [this](const std::string& name) -> Entry* {
+		for(auto& entry : entries) {
+			if(entry.name == name) {
+				return nullptr;
+			}
+		}
+		entries.emplace_back();
+		entries.back().name = name;
+		return &entries.back();
+	};
+	for(const auto& name : tags_main) {
+		auto entry = add(name);
+		if(entry) {
+			entry->main = true;
+		}
+	}
+	for(const auto& tag : tags_other) {
+		auto entry = add(tag.name);
+		if(entry) {
+			entry->other = &tag;
+		}
+	}
+	size_t size = 1;
+	while(size < entries.size() * 2) {
+		size <<= 1;
+	}
+	// grow the table if no seed gives distinct slots
+	while(true) {
+		mask = size - 1;
+		for(seed = 0; seed < 10000; seed++) {
+			slots.assign(size, -1);
+			bool ok = true;
+			for(size_t i = 0; i < entries.size() && ok; i++) {
+				auto& slot = slots[hash(entries[i].name, seed) & mask];
+				ok = slot < 0;
+				slot = static_cast<int>(i);
+			}
+			if(ok) {
+				return;
+			}
+		}
+		size <<= 1;
+	}
+}
+
+uint64_t Tag_table::hash(const std::string& str, uint64_t seed) {
+	uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+	for(auto ch : str) {
+		h ^= static_cast<unsigned char>(ch);
+		h *= 1099511628211ULL;
+	}
+	return h ^ (h >> 32);
+}
+
+const Tag_table::Entry* Tag_table::find(const std::string& name) const {
+	int i = slots[hash(name, seed) & mask];
+	if(i < 0 || entries[i].name != name) {
+		return nullptr;
+	}
+	return &entries[i];
+}
+
+std::string Node_attrs::get(const std::string& name) const {
+	return utils::decode_refs(n.get_attr(name));
+}
+
+void Scan_attrs::parse(const char* data, size_t size) {
+	auto is_space = [](char ch) {
+		return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f';
+	};
+	auto lower = [](char ch) {
+		return ch >= 'A' && ch <= 'Z' ? static_cast<char>(ch + 32) : ch;
+	};
+	const char* p = data + 1;
+	const char* end = data + size - 1;
+	name.clear();
+	cnt = 0;
+	while(p < end && !is_space(*p) && *p != '/') {
+		name += lower(*p++);
+	}
+	while(true) {
+		while(p < end && (is_space(*p) || *p == '/')) {
+			p++;
+		}
+		if(p >= end) {
+			break;
+		}
+		// entries are reused between tags to keep their buffers
+		if(cnt == attrs.size()) {
+			attrs.emplace_back();
+		}
+		auto& attr = attrs[cnt++];
+		attr.first.clear();
+		attr.second.clear();
+		do {
+			attr.first += lower(*p++);
+		} while(p < end && !is_space(*p) && *p != '=' && *p != '/');
+		while(p < end && is_space(*p)) {
+			p++;
+		}
+		if(p >= end || *p != '=') {
+			continue;
+		}
+		p++;
+		while(p < end && is_space(*p)) {
+			p++;
+		}
+		if(p < end && (*p == '"' || *p == '\'')) {
+			char quote = *p++;
+			const char* value = p;
+			while(p < end && *p != quote) {
+				p++;
+			}
+			attr.second.assign(value, p);
+			if(p < end) {
+				p++;
+			}
+		} else {
+			const char* value = p;
+			while(p < end && !is_space(*p)) {
+				p++;
+			}
+			attr.second.assign(value, p);
+		}
+	}
+}
+
+std::string Scan_attrs::get(const std::string& attr_name) const {
+	for(size_t i = 0; i < cnt; i++) {
+		if(attrs[i].first == attr_name) {
+			return utils::decode_refs(attrs[i].second);
+		}
+	}
+	return "";
+}
+
+void Html_stream::reset() {
+	buf.clear();
+	pos = 0;
+	safe = 0;
+	tag_start = 0;
+	quote = 0;
+	raw_end.clear();
+	state = state_t::text;
+}
+
+// Appends data, out gets the part that is ready once it is large enough.
+void Html_stream::feed(const char* data, size_t size, std::string& out) {
+	buf.append(data, size);
+	scan();
+	if(safe < min_chunk) {
+		return;
+	}
+	out.assign(buf, 0, safe);
+	drop(safe);
+}
+
+// Appends data, on_tag gets each complete open tag.
+void Html_stream::feed(const char* data, size_t size, const Tag_callback& on_tag) {
+	buf.append(data, size);
+	scan(&on_tag);
+	drop(safe);
+}
+
+void Html_stream::finish(std::string& out) {
+	out.swap(buf);
+	reset();
+}
+
+// A tag left open at the end is not passed on.
+void Html_stream::finish(const Tag_callback&) {
+	reset();
+}
+
+void Html_stream::drop(size_t size) {
+	buf.erase(0, size);
+	pos -= size;
+	tag_start = tag_start >= size ? tag_start - size : 0;
+	safe -= size;
+}
+
+void Html_stream::scan(const Tag_callback* on_tag) {
+	while(pos < buf.size()) {
+		switch(state) {
+			case state_t::text: {
+				auto lt = buf.find('<', pos);
+				if(lt == std::string::npos) {
+					pos = safe = buf.size();
+					break;
+				}
+				safe = lt;
+				// need 4 bytes to tell a comment from a tag
+				if(buf.size() - lt < 4) {
+					pos = lt;
+					return;
+				}
+				tag_start = lt;
+				quote = 0;
+				if(!buf.compare(lt, 4, "<!--")) {
+					state = state_t::comment;
+					pos = lt + 4;
+				} else {
+					state = state_t::tag;
+					pos = lt + 1;
+				}
+				break;
+			}
+			case state_t::tag: {
+				const char* first = buf.data();
+				const char* last = first + buf.size();
+				while(pos < buf.size()) {
+					if(quote) {
+						auto p = static_cast<const char*>(std::memchr(first + pos, quote, buf.size() - pos));
+						if(!p) {
+							pos = buf.size();
+							break;
+						}
+						pos = p - first + 1;
+						quote = 0;
+						continue;
+					}
+					pos = utils::find_tag_end(first + pos, last) - first;
+					if(pos == buf.size() || buf[pos] == '>') {
+						break;
+					}
+					// a quote inside a name or an unquoted value is a plain char
+					size_t prev = pos;
+					while(prev > tag_start && std::isspace(static_cast<unsigned char>(buf[prev - 1]))) {
+						prev--;
+					}
+					if(buf[prev - 1] == '=') {
+						quote = buf[pos];
+					}
+					pos++;
+				}
+				if(pos == buf.size()) {
+					return;
+				}
+				pos++;
+				safe = pos;
+				state = state_t::text;
+				if(on_tag && std::isalpha(static_cast<unsigned char>(buf[tag_start + 1]))) {
+					(*on_tag)(buf.data() + tag_start, pos - tag_start);
+				}
+				if(buf[tag_start + 1] != '/' && buf[pos - 2] != '/') {
+					size_t end = tag_start + 1;
+					while(end < pos && std::isalnum(static_cast<unsigned char>(buf[end]))) {
+						end++;
+					}
+					auto name = boost::to_lower_copy(buf.substr(tag_start + 1, end - tag_start - 1));
+					if(name == "script" || name == "style") {
+						raw_end = "</" + name;
+						state = state_t::rawtext;
+					}
+				}
+				break;
+			}
+			case state_t::comment: {
+				auto end = buf.find("-->", pos);
+				if(end == std::string::npos) {
+					// keep the tail, it may be the start of "-->"
+					size_t keep = std::min<size_t>(buf.size() - tag_start - 4, 2);
+					buf.erase(tag_start + 4, buf.size() - keep - tag_start - 4);
+					pos = buf.size() - keep;
+					return;
+				}
+				pos = safe = end + 3;
+				state = state_t::text;
+				break;
+			}
+			case state_t::rawtext: {
+				// content starts at safe, right after the opening tag
+				size_t end = std::string::npos;
+				for(auto i = buf.find("</", pos); i != std::string::npos; i = buf.find("</", i + 1)) {
+					if(buf.size() - i < raw_end.size()) {
+						break;
+					}
+					if(boost::iequals(buf.substr(i, raw_end.size()), raw_end)) {
+						end = i;
+						break;
+					}
+				}
+				if(end == std::string::npos) {
+					size_t keep = std::min(buf.size() - safe, raw_end.size());
+					buf.erase(safe, buf.size() - keep - safe);
+					pos = buf.size() - keep;
+					return;
+				}
+				buf.erase(safe, end - safe);
+				tag_start = safe;
+				pos = safe + 2;
+				quote = 0;
+				state = state_t::tag;
+				break;
+			}
+		}
+	}
+}
+
+void Thread::init() {
+	p.set_callback([this](html::node& n) {
+		if(n.type_node != html::node_t::tag || n.type_tag != html::tag_t::open) {
+			return;
+		}
+		handle_tag(n.tag_name, Node_attrs(n));
+	});
+	// without validation links are read straight from the tags, no tree is built
+	scan_links = !main_obj.param_log_bad_html;
+	on_tag = [this](const char* data, size_t size) {
+		scan_attrs.parse(data, size);
+		handle_tag(scan_attrs.tag_name(), scan_attrs);
+	};
+	if(main_obj.param_log_bad_html) {
+		p.set_callback([this](html::err_t e, html::node& n) {
+			std::string msg;
+			if(e == html::err_t::tag_not_closed) {
+				html::node* current = &n;
+				while(current->get_parent()) {
+					msg.insert(0, " " + current->tag_name);
+					current = current->get_parent();
+				}
+				msg.insert(0, "Unclosed tag:");
+			}
+			if(main_obj.log_bad_html_file) {
+				main_obj.log_bad_html_file.write({msg, std::to_string(m_url->id)});
+			}
+			if(main_obj.log_bad_html_console) {
+				main_obj.log_bad_html_console.write({msg, m_url->resolved});
+			}
+		});
+	}
+}
+
+void Thread::handle_tag(const std::string& tag_name, const Tag_attrs& attrs) {
+	if(tag_name == "base") {
+		auto href = attrs.get("href");
+		if(!href.empty()) {
+			page.base.set(href);
+		}
+		return;
+	}
+	auto entry = tag_table.find(tag_name);
+	if(!entry) {
+		return;
+	}
+	if(entry->main) {
+		auto href = attrs.get("href");
+		if(!href.empty()) {
+			Url_new url;
+			url.found = href;
+			url.handle = url_handle_t::query_parse;
+			set_url(url);
+		}
+		return;
+	}
+	if(main_obj.link_check && entry->other) {
+		for(auto& attr : entry->other->attr) {
+			auto href = attrs.get(attr.name);
+			if(href.empty()) {
+				continue;
+			}
+			if(attr.pre && !attr.pre(attrs, href, this)) {
+				continue;
+			}
+			Url_new url;
+			url.found = href;
+			url.handle = url_handle_t::query;
+			set_url(url);
+		}
+	}
+}
+
+void Thread::start() {
+	init();
+	uthread.reset(new std::thread(&Thread::load, this));
+}
+
+void Thread::join() {
+	if(uthread != nullptr) {
+		uthread->join();
+		uthread = nullptr;
+	}
+}
+
+void Thread::load() {
+	try {
+		main_obj.thread_work++;
+		while(main_obj.get_url(this)) {
+			if(!ssl_supported()) {
+				main_obj.release_url(m_url);
+				continue;
+			}
+			cli = main_obj.client_pool.get(m_url);
+			page.prepare(m_url);
+			Timer tmr;
+			if(m_url->handle == url_handle_t::query_parse && main_obj.stream_parse) {
+				result = std::make_shared<httplib::Result>(cli->Get(m_url->path(), page.request_headers(), [this](const httplib::Response& res) {
+					verify_result = m_url->ssl ? cli->get_openssl_verify_result() : 0;
+					return http_headers(res);
+				}, [this](const char* data, size_t size) {
+					return http_body(data, size);
+				}));
+			} else if(m_url->handle == url_handle_t::query_parse) {
+				result = std::make_shared<httplib::Result>(cli->Get(m_url->path(), page.request_headers()));
+			} else {
+				result = std::make_shared<httplib::Result>(cli->Head(m_url->path()));
+			}
+			verify_result = m_url->ssl ? cli->get_openssl_verify_result() : 0;
+			request_finished(tmr.seconds());
+			main_obj.client_pool.put(m_url, cli, static_cast<bool>(*result));
+			main_obj.release_url(m_url);
+		}
+	} catch(...) {
+		main_obj.set_exception(std::current_exception());
+	}
+}
+
+bool Thread::ssl_supported() {
+#ifndef CPPHTTPLIB_OPENSSL_SUPPORT
+	if(m_url->ssl) {
+		if(main_obj.log_error_reply_file) {
+			main_obj.log_error_reply_file.write({"HTTPS not supported", m_url->resolved, std::to_string(m_url->parent)});
+		}
+		if(main_obj.log_error_reply_console) {
+			main_obj.log_error_reply_console.write({"HTTPS not supported", m_url->resolved, main_obj.get_resolved(m_url->parent)});
+		}
+		m_url->done.store(true, std::memory_order_release);
+		return false;
+	}
+#endif
+	return true;
+}
+
+void Thread::request_finished(double time) {
+	if(!page.active) {
+		page.base.set(m_url->resolved);
+	}
+	m_url->time += time;
+	m_url->try_cnt++;
+	if(main_obj.log_info_console) {
+		main_obj.log_info_console.write({std::to_string(id), std::to_string(time), m_url->resolved, main_obj.get_resolved(m_url->parent)});
+	}
+	retried = false;
+	http_finished();
+	page.active = false;
+	if(page.wire) {
+		main_obj.transfer.add(m_url->host, page.wire, page.body);
+		page.wire = 0;
+		page.body = 0;
+	}
+	// a retried url is owned by the retry queue already
+	if(!retried) {
+		if(m_url->is_html) {
+			page_done();
+			// a page whose body failed after the headers is not listed
+			if(main_obj.sitemap && !m_url->duplicate && !m_url->error) {
+				main_obj.sitemap_sink.add(m_url);
+			}
+		}
+		m_url->done.store(true, std::memory_order_release);
+	}
+}
+
+void Thread::Page::prepare(const Url_struct* url) {
+	has_prev = main_obj.recrawl.find(url, prev_state);
+	state = Page_state();
+	hash = Hash128();
+	decoder.init("");
+	corrupt = false;
+	wire = 0;
+	body = 0;
+	links = 0;
+}
+
+httplib::Headers Thread::Page::request_headers() const {
+	httplib::Headers headers;
+	if(main_obj.compression && !Decoder::accepted().empty()) {
+		headers.emplace("Accept-Encoding", Decoder::accepted());
+	}
+	if(has_prev) {
+		if(!prev_state.etag.empty()) {
+			headers.emplace("If-None-Match", prev_state.etag);
+		}
+		if(!prev_state.last_modified.empty()) {
+			headers.emplace("If-Modified-Since", prev_state.last_modified);
+		}
+	}
+	return headers;
+}
+
+// Sets lastmod of a finished html page and keeps its state for the next run.
+// Last-Modified is used if the server sends it, otherwise the page keeps the
+// lastmod of the previous run unless its content has changed.
+void Thread::page_done() {
+	auto& reply = *result;
+	if(!reply || (reply->status != 200 && reply->status != 304)) {
+		return;
+	}
+	auto& state = page.state;
+	state.etag = reply->get_header_value("ETag");
+	state.last_modified = reply->get_header_value("Last-Modified");
+	if(reply->status == 304 && page.prev()) {
+		if(state.etag.empty()) {
+			state.etag = page.prev()->etag;
+		}
+		if(state.last_modified.empty()) {
+			state.last_modified = page.prev()->last_modified;
+		}
+	}
+	int64_t t;
+	if(utils::parse_http_date(state.last_modified, t)) {
+		m_url->lastmod = t;
+	} else if(page.prev() && page.prev()->hash == state.hash) {
+		m_url->lastmod = page.prev()->lastmod;
+	} else if(page.prev()) {
+		m_url->lastmod = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+	if(main_obj.recrawl) {
+		state.lastmod = m_url->lastmod;
+		state.charset = main_obj.charsets.get(m_url->charset);
+		main_obj.recrawl.add(m_url, state);
+	}
+}
+
+// The page has not changed since the previous run, its outlinks are
+// added again without fetching or parsing the body.
+void Thread::reuse_page() {
+	auto prev = page.prev();
+	m_url->is_html = true;
+	if(!prev->charset.empty()) {
+		m_url->charset = main_obj.charsets.add(prev->charset);
+	}
+	page.state.hash = prev->hash;
+	main_obj.recrawl.count_unchanged();
+	const char* p = prev->links.data();
+	const char* end = p + prev->links.size();
+	while(p < end) {
+		Url_new url;
+		url.handle = static_cast<url_handle_t>(*p);
+		uint32_t size;
+		std::memcpy(&size, p + 1, sizeof(size));
+		p += 1 + sizeof(size);
+		url.found.assign(p, size);
+		p += size;
+		set_url(url);
+	}
+}
+
+// Decides from the headers whether the body is parsed while it downloads.
+bool Thread::http_headers(const httplib::Response& res) {
+	page.active = false;
+	if(m_url->handle != url_handle_t::query_parse || res.status != 200) {
+		return true;
+	}
+	if(m_url->ssl && verify_result != X509_V_OK) {
+		return true;
+	}
+	auto content_type = res.get_header_value("Content-Type");
+	if(content_type.find("text/html") == std::string::npos) {
+		return true;
+	}
+	// unsupported encodings are reported after the whole body
+	if(!page.decoder.init(res.get_header_value("Content-Encoding"))) {
+		return true;
+	}
+	html_found(content_type);
+	page.base.set(m_url->resolved);
+	page.stream.reset();
+	page.active = true;
+	return true;
+}
+
+bool Thread::http_body(const char* data, size_t size) {
+	if(!page.active || page.corrupt) {
+		return true;
+	}
+	page.wire += size;
+	if(!page.decoder.feed(data, size, [this](const char* out, size_t n) {
+		http_content(out, n);
+	})) {
+		// the rest of the page is not readable
+		page.corrupt = true;
+	}
+	return true;
+}
+
+void Thread::http_content(const char* data, size_t size) {
+	page.body += size;
+	if(main_obj.recrawl) {
+		page.hash.update(data, size);
+	}
+	if(scan_links) {
+		page.stream.feed(data, size, on_tag);
+	} else {
+		std::string piece;
+		page.stream.feed(data, size, piece);
+		if(!piece.empty()) {
+			p.parse(piece);
+		}
+	}
+}
+
+void Thread::html_found(const std::string& content_type) {
+	// a retried page may already be known
+	if(m_url->is_html) {
+		return;
+	}
+	m_url->is_html = true;
+	// charset from header
+	auto pos = content_type.find("charset=");
+	if(pos != std::string::npos) {
+		m_url->charset = main_obj.charsets.add(content_type.substr(pos + 8));
+	}
+}
+
+void Thread::http_finished() {
+	auto& reply = *result;
+	if(!reply) {
+		if(m_url->try_cnt < main_obj.try_limit) {
+			// links of a partial body are not added again by the next try
+			m_url->links_sent = std::max(m_url->links_sent, page.links);
+			retried = true;
+			main_obj.try_again(m_url, worker());
+		} else {
+			auto error = httplib::to_string(reply.error());
+			m_url->error = main_obj.errors.add(error);
+			error_reply(error);
+		}
+		return;
+	}
+	if(m_url->ssl) {
+		if(verify_result != X509_V_OK) {
+			auto error = std::string("Certificate verification error: ") + X509_verify_cert_error_string(verify_result);
+			m_url->error = main_obj.errors.add(error);
+			error_reply(error);
+			return;
+		}
+	}
+	if(((reply->status >= 500 && reply->status < 600) || reply->status == 429) && m_url->try_cnt < main_obj.try_limit) {
+		int delay = -1;
+		if(reply->status == 429 || reply->status == 503) {
+			auto sec = utils::retry_after(reply->get_header_value("Retry-After"));
+			if(sec >= 0) {
+				delay = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(sec) * 1000, INT32_MAX));
+			}
+		}
+		retried = true;
+		main_obj.try_again(m_url, worker(), delay);
+		return;
+	}
+	if(reply->status == 304 && page.prev()) {
+		reuse_page();
+		return;
+	}
+	if(reply->status >= 300 && reply->status < 400) {
+		m_url->error = main_obj.errors.add("Redirect");
+		if(main_obj.log_redirect_file) {
+			main_obj.log_redirect_file.write({m_url->resolved, std::to_string(m_url->parent)});
+		}
+		if(main_obj.log_redirect_console) {
+			main_obj.log_redirect_console.write({m_url->resolved, main_obj.get_resolved(m_url->parent)});
+		}
+		if(m_url->redirect_cnt > main_obj.redirect_limit) {
+			error_reply("Redirect limit reached");
+			return;
+		}
+		if(reply->has_header("Location")) {
+			Url_new url;
+			url.found = reply->get_header_value("Location");
+			url.handle = url_handle_t::query_parse;
+			url.redirect_cnt = m_url->redirect_cnt + 1;
+			set_url(url);
+		}
+		return;
+	}
+	if(reply->status != 200) {
+		auto error = "Code:" + std::to_string(reply->status);
+		m_url->error = main_obj.errors.add(error);
+		error_reply(error);
+		return;
+	}
+	if(m_url->handle == url_handle_t::query) {
+		return;
+	}
+	if(!reply->has_header("Content-Type")) {
+		m_url->error = main_obj.errors.add("Content-Type empty");
+		error_reply("Content-Type empty");
+		return;
+	}
+	// check html
+	auto content_type = reply->get_header_value("Content-Type");
+	if(content_type.find("text/html") == std::string::npos) {
+		return;
+	}
+	if(page.corrupt) {
+		m_url->error = main_obj.errors.add("Content-Encoding error");
+		error_reply("Content-Encoding error");
+		return;
+	}
+	if(page.active) {
+		page.state.hash = page.hash.digest();
+	}
+	if(page.active && scan_links) {
+		page.stream.finish(on_tag);
+		return;
+	}
+	if(page.active) {
+		std::string piece;
+		page.stream.finish(piece);
+		if(!piece.empty()) {
+			p.parse(piece);
+		}
+		return;
+	}
+	if(!decode_body(*reply)) {
+		m_url->error = main_obj.errors.add("Content-Encoding error");
+		error_reply("Content-Encoding error: " + reply->get_header_value("Content-Encoding"));
+		return;
+	}
+	html_found(content_type);
+	if(main_obj.recrawl || main_obj.content_dedup) {
+		page.state.hash = utils::hash128(reply->body.data(), reply->body.size());
+	}
+	// servers without validators still send the same body
+	if(page.prev() && page.prev()->hash == page.state.hash) {
+		reuse_page();
+		return;
+	}
+	if(main_obj.content_dedup && duplicate(page.state.hash, reply->body)) {
+		return;
+	}
+	parse_body(reply->body);
+}
+
+// Replaces a whole encoded body with its decoded content.
+bool Thread::decode_body(httplib::Response& res) {
+	page.wire += res.body.size();
+	if(!page.decoder.init(res.get_header_value("Content-Encoding"))) {
+		return false;
+	}
+	if(page.decoder) {
+		std::string out;
+		if(!page.decoder.feed(res.body.data(), res.body.size(), [&out](const char* data, size_t size) {
+			out.append(data, size);
+		})) {
+			return false;
+		}
+		res.body.swap(out);
+	}
+	page.body += res.body.size();
+	return true;
+}
+
+// Bodies served under several urls are listed once, copies point to the
+// original. Only exact copies are not parsed, a near copy may still have
+// links of its own.
+bool Thread::duplicate(const Fingerprint& hash, const std::string& body) {
+	size_t shingles;
+	auto sim = Content_index::simhash(body.data(), body.size(), shingles);
+	// pages with almost no text, like script only pages or frame sets,
+	// all get a similar SimHash and are neither compared nor indexed
+	if(shingles < Content_index::min_shingles) {
+		return false;
+	}
+	bool same = false;
+	m_url->duplicate = main_obj.content_index.find_add(hash, sim, m_url->id, same);
+	return m_url->duplicate != 0 && same;
+}
+
+void Thread::parse_body(const std::string& body) {
+	if(!scan_links) {
+		p.parse(body);
+		return;
+	}
+	page.stream.reset();
+	page.stream.feed(body.data(), body.size(), on_tag);
+	page.stream.finish(on_tag);
+}
+
+void Thread::error_reply(const std::string& msg) {
+	if(main_obj.log_error_reply_file) {
+		main_obj.log_error_reply_file.write({msg, m_url->resolved, std::to_string(m_url->parent)});
+	}
+	if(main_obj.log_error_reply_console) {
+		main_obj.log_error_reply_console.write({msg, m_url->resolved, main_obj.get_resolved(m_url->parent)});
+	}
+}
+
+void Thread::set_url(Url_new& new_url) {
+	new_url.parent = m_url->id;
+	auto handle = new_url.handle;
+	// the same page gives the same links in the same order
+	bool sent = page.links++ < m_url->links_sent;
+	if(main_obj.handle_url(new_url, page.base)) {
+		if(main_obj.recrawl && m_url->handle == url_handle_t::query_parse) {
+			page.state.add_link(handle, new_url.resolved);
+		}
+		if(!sent) {
+			main_obj.set_url(new_url, worker());
+		}
+	} else if(!sent) {
+		if(main_obj.log_ignored_url_file) {
+			main_obj.log_ignored_url_file.write({new_url.found, std::to_string(new_url.parent)});
+		}
+		if(main_obj.log_ignored_url_console) {
+			main_obj.log_ignored_url_console.write({new_url.found, main_obj.get_resolved(new_url.parent)});
+		}
+	}
+}
+
+#ifdef LINUX_PLATFORM
+Fetch_engine::Fetch_engine(int id, size_t inflight) : handler(id), inflight(inflight ? inflight : 1) {
+	// a peer closing the socket must not terminate the process
+	signal(SIGPIPE, SIG_IGN);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0) {
+		throw std::runtime_error("Can not create epoll instance");
+	}
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	ssl_ctx = SSL_CTX_new(TLS_client_method());
+	if(!ssl_ctx) {
+		throw std::runtime_error("Can not create SSL context");
+	}
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, nullptr);
+	if(main_obj.cert_verification) {
+		if(!main_obj.ca_cert_file_path.empty()) {
+			SSL_CTX_load_verify_locations(ssl_ctx, main_obj.ca_cert_file_path.c_str(), nullptr);
+		} else if(!main_obj.ca_cert_dir_path.empty()) {
+			SSL_CTX_load_verify_locations(ssl_ctx, nullptr, main_obj.ca_cert_dir_path.c_str());
+		} else {
+			SSL_CTX_set_default_verify_paths(ssl_ctx);
+		}
+	}
+#endif
+}
+
+Fetch_engine::~Fetch_engine() {
+	join();
+	while(!conns.empty()) {
+		close(conns.begin()->first);
+	}
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	SSL_CTX_free(ssl_ctx);
+#endif
+	::close(epfd);
+}
+
+void Fetch_engine::start() {
+	handler.init();
+	uthread.reset(new std::thread(&Fetch_engine::loop, this));
+}
+
+void Fetch_engine::join() {
+	if(uthread != nullptr) {
+		uthread->join();
+		uthread = nullptr;
+	}
+}
+
+void Fetch_engine::loop() {
+	try {
+		main_obj.thread_work++;
+		std::vector<epoll_event> events(256);
+		while(true) {
+			bool run = true;
+			while(active < inflight) {
+				run = main_obj.poll_url(&handler);
+				if(!run || !handler.m_url) {
+					break;
+				}
+				begin(handler.m_url);
+			}
+			if(!run) {
+				abort_all();
+				main_obj.get_url(&handler);
+				break;
+			}
+			if(!active) {
+				// nothing in flight, wait for new urls like a blocking thread
+				if(!main_obj.get_url(&handler)) {
+					break;
+				}
+				begin(handler.m_url);
+				continue;
+			}
+			int n = epoll_wait(epfd, events.data(), static_cast<int>(events.size()), active < inflight ? 10 : 100);
+			if(n < 0 && errno != EINTR) {
+				throw std::runtime_error("epoll_wait failed");
+			}
+			for(int i = 0; i < n; i++) {
+				auto c = static_cast<Conn*>(events[i].data.ptr);
+				if(conns.count(c)) {
+					handle(c, events[i].events);
+				}
+			}
+			check_timeouts();
+			closed.clear();
+		}
+	} catch(...) {
+		abort_all();
+		main_obj.set_exception(std::current_exception());
+	}
+}
+
+void Fetch_engine::begin(Url_struct* url, bool reuse) {
+	handler.m_url = url;
+	if(!handler.ssl_supported()) {
+		main_obj.release_url(url);
+		return;
+	}
+	auto host = main_obj.hosts.get(url->host);
+	std::string key(url->ssl ? "https" : "http");
+	key += "://" + host;
+	Conn* c = nullptr;
+	auto it = idle.find(key);
+	if(reuse && it != idle.end() && !it->second.empty()) {
+		c = it->second.back();
+		it->second.pop_back();
+		c->reused = true;
+		set_events(c, EPOLLOUT);
+	} else {
+		std::unique_ptr<Conn> conn(new Conn);
+		conn->key = key;
+		conn->host = host;
+		auto err = open(conn.get(), url->ssl);
+		if(err != httplib::Error::Success) {
+			done(url, 0, nullptr, err, 0);
+			return;
+		}
+		c = conn.get();
+		conns[c] = std::move(conn);
+	}
+	main_obj.client_pool.count(c->reused);
+	c->url = url;
+	c->head = url->handle != url_handle_t::query_parse;
+	c->out = c->head ? "HEAD " : "GET ";
+	c->out += url->path() + " HTTP/1.1\r\nHost: " + host + "\r\nAccept: */*\r\nUser-Agent: sitemap\r\n";
+	c->page = Thread::Page();
+	c->page.prepare(url);
+	if(!c->head) {
+		for(const auto& header : c->page.request_headers()) {
+			c->out += header.first + ": " + header.second + "\r\n";
+		}
+	}
+	c->out += main_obj.keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	c->out_pos = 0;
+	c->in.clear();
+	c->in_pos = 0;
+	c->res.reset(new httplib::Response);
+	c->head_done = false;
+	c->read_any = false;
+	c->body = Conn::body_t::none;
+	c->chunk_data = false;
+	c->chunk_last = false;
+	c->timer.reset();
+	if(c->state == Conn::state_t::idle) {
+		c->state = Conn::state_t::send;
+		c->deadline = clock_::now() + std::chrono::seconds(CPPHTTPLIB_WRITE_TIMEOUT_SECOND);
+	} else {
+		c->deadline = clock_::now() + std::chrono::seconds(CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND);
+	}
+	active++;
+}
+
+httplib::Error Fetch_engine::open(Conn* c, bool ssl) {
+	sockaddr_storage addr;
+	socklen_t len;
+	if(!resolve(c->host, ssl ? 443 : 80, addr, len)) {
+		return httplib::Error::Connection;
+	}
+	c->fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(c->fd < 0) {
+		return httplib::Error::Connection;
+	}
+	if(!bind_interface(c->fd, addr.ss_family)) {
+		::close(c->fd);
+		return httplib::Error::BindIPAddress;
+	}
+	if(connect(c->fd, reinterpret_cast<sockaddr*>(&addr), len) < 0 && errno != EINPROGRESS) {
+		::close(c->fd);
+		return httplib::Error::Connection;
+	}
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	if(ssl) {
+		c->ssl = SSL_new(ssl_ctx);
+		if(!c->ssl) {
+			::close(c->fd);
+			return httplib::Error::SSLConnection;
+		}
+		SSL_set_fd(c->ssl, c->fd);
+		SSL_set_tlsext_host_name(c->ssl, c->host.c_str());
+		SSL_set_connect_state(c->ssl);
+	}
+#endif
+	epoll_event ev{};
+	ev.events = EPOLLOUT;
+	ev.data.ptr = c;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+		SSL_free(c->ssl);
+#endif
+		::close(c->fd);
+		return httplib::Error::Connection;
+	}
+	c->events = EPOLLOUT;
+	c->state = Conn::state_t::connect;
+	return httplib::Error::Success;
+}
+
+bool Fetch_engine::resolve(const std::string& host, int port, sockaddr_storage& addr, socklen_t& len) {
+	std::string key = host + ":" + std::to_string(port);
+	auto it = dns.find(key);
+	if(it != dns.end()) {
+		addr = it->second.first;
+		len = it->second.second;
+		return true;
+	}
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* info = nullptr;
+	if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &info) != 0 || !info) {
+		return false;
+	}
+	std::memcpy(&addr, info->ai_addr, info->ai_addrlen);
+	len = info->ai_addrlen;
+	freeaddrinfo(info);
+	dns[key] = std::make_pair(addr, len);
+	return true;
+}
+
+bool Fetch_engine::bind_interface(int fd, int family) {
+	const auto& name = main_obj.param_interface;
+	if(name.empty()) {
+		return true;
+	}
+	ifaddrs* list = nullptr;
+	if(getifaddrs(&list) == 0) {
+		for(auto ifa = list; ifa; ifa = ifa->ifa_next) {
+			if(ifa->ifa_addr && name == ifa->ifa_name && ifa->ifa_addr->sa_family == family) {
+				socklen_t len = family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+				bool ret = bind(fd, ifa->ifa_addr, len) == 0;
+				freeifaddrs(list);
+				return ret;
+			}
+		}
+		freeifaddrs(list);
+	}
+	addrinfo hints{};
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* info = nullptr;
+	if(getaddrinfo(name.c_str(), nullptr, &hints, &info) != 0 || !info) {
+		return false;
+	}
+	bool ret = bind(fd, info->ai_addr, info->ai_addrlen) == 0;
+	freeaddrinfo(info);
+	return ret;
+}
+
+void Fetch_engine::set_events(Conn* c, uint32_t events) {
+	if(c->events == events) {
+		return;
+	}
+	epoll_event ev{};
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = events;
+}
+
+int Fetch_engine::io_read(Conn* c, char* buf, size_t size) {
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	if(c->ssl) {
+		ERR_clear_error();
+		int r = SSL_read(c->ssl, buf, static_cast<int>(size));
+		if(r > 0) {
+			return r;
+		}
+		int e = SSL_get_error(c->ssl, r);
+		if(e == SSL_ERROR_WANT_READ) {
+			set_events(c, EPOLLIN);
+			return -2;
+		}
+		if(e == SSL_ERROR_WANT_WRITE) {
+			set_events(c, EPOLLOUT);
+			return -2;
+		}
+		// many servers close the connection without close_notify
+		if(e == SSL_ERROR_ZERO_RETURN || (e == SSL_ERROR_SYSCALL && !ERR_peek_error())) {
+			return 0;
+		}
+		return -1;
+	}
+#endif
+	while(true) {
+		auto r = recv(c->fd, buf, size, 0);
+		if(r >= 0) {
+			return static_cast<int>(r);
+		}
+		if(errno == EINTR) {
+			continue;
+		}
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			set_events(c, EPOLLIN);
+			return -2;
+		}
+		return -1;
+	}
+}
+
+int Fetch_engine::io_write(Conn* c, const char* buf, size_t size) {
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	if(c->ssl) {
+		ERR_clear_error();
+		int r = SSL_write(c->ssl, buf, static_cast<int>(size));
+		if(r > 0) {
+			return r;
+		}
+		int e = SSL_get_error(c->ssl, r);
+		if(e == SSL_ERROR_WANT_READ) {
+			set_events(c, EPOLLIN);
+			return -2;
+		}
+		if(e == SSL_ERROR_WANT_WRITE) {
+			set_events(c, EPOLLOUT);
+			return -2;
+		}
+		return -1;
+	}
+#endif
+	while(true) {
+		auto r = send(c->fd, buf, size, MSG_NOSIGNAL);
+		if(r >= 0) {
+			return static_cast<int>(r);
+		}
+		if(errno == EINTR) {
+			continue;
+		}
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			set_events(c, EPOLLOUT);
+			return -2;
 		}
+		return -1;
 	}
-	boost::url uri_;
-	uri_.set_path(b.path());
-	if(b.has_query()) {
-		uri_.set_query(b.query());
-	}
-	auto path = uri_.buffer();
-	if(uri_.empty()) {
-		path = "/";
-	}
-	url_new->path = path;
-	url_new->normalize = uri_normalize(b);
-	url_new->resolved = b.buffer();
-	url_new->ssl = b.scheme() == "https";
-	url_new->host = b.host();
-	url_new->base_href = url_new->resolved;
-	return true;
 }
 
-void Main::finished() {
-	if(log_info_file) {
-		for(auto it = url_all.begin(); it != url_all.end(); ++it) {
-			log_info_file.write({
-				std::to_string((*it)->id),
-				std::to_string((*it)->parent),
-				std::to_string((*it)->time),
-				std::to_string((*it)->try_cnt),
-				std::to_string((*it)->cnt),
-				std::to_string((*it)->is_html),
-				(*it)->found,
-				(*it)->resolved,
-				(*it)->charset,
-				(*it)->error
-			});
+void Fetch_engine::handle(Conn* c, uint32_t events) {
+	if(c->state == Conn::state_t::idle) {
+		// the server closed a pooled connection or sent something unexpected
+		close(c);
+		return;
+	}
+	auto err = httplib::Error::Success;
+	bool finished = false;
+	if(c->state == Conn::state_t::connect) {
+		int so_error = 0;
+		socklen_t len = sizeof(so_error);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+		if(so_error || (events & (EPOLLERR | EPOLLHUP))) {
+			err = httplib::Error::Connection;
+		} else {
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+			c->state = c->ssl ? Conn::state_t::handshake : Conn::state_t::send;
+#else
+			c->state = Conn::state_t::send;
+#endif
+			c->deadline = clock_::now() + std::chrono::seconds(CPPHTTPLIB_WRITE_TIMEOUT_SECOND);
 		}
 	}
-	if(sitemap) {
-		auto base = uri.scheme().data() + std::string("://") + uri.authority().data();
-		int i = 1;
-		int j = 0;
-		std::streamoff wrap_length = 0;
-		std::streamoff tag_length = 0;
-		std::streamoff pos = 0;
-		std::streamoff outpos = 0;
-		XML_writer writer(sitemap_file);
-		writer.write_start_doc();
-		writer.write_start_el("urlset");
-		writer.write_attr("xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
-		writer.write_end_el();
-		writer.write_end_doc();
-		writer.flush();
-		wrap_length = sitemap_file.tellp();
-		wrap_length += 1;
-		sitemap_file.close();
-		std::string file_name(sitemap_dir + "/" + xml_name + std::to_string(i) + ".xml");
-		sitemap_file.open(file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-		if(!sitemap_file.is_open()) {
-			throw std::runtime_error("Can not open " + file_name);
-		}
-		writer.write_start_doc();
-		writer.write_start_el("urlset");
-		writer.write_attr("xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
-		for(auto it = url_all.begin(); it != url_all.end(); ++it) {
-			if((*it)->handle == url_handle_t::query) {
-				continue;
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	if(err == httplib::Error::Success && c->state == Conn::state_t::handshake) {
+		ERR_clear_error();
+		int r = SSL_connect(c->ssl);
+		if(r != 1) {
+			int e = SSL_get_error(c->ssl, r);
+			if(e == SSL_ERROR_WANT_READ) {
+				set_events(c, EPOLLIN);
+				return;
 			}
-			if((*it)->handle == url_handle_t::query_parse && !(*it)->is_html) {
-				continue;
+			if(e == SSL_ERROR_WANT_WRITE) {
+				set_events(c, EPOLLOUT);
+				return;
 			}
-			size_t str_size = 0;
-			std::vector<std::pair<std::string, std::string>> tags;
-			tags.emplace_back("loc", writer.escape_str((*it)->resolved));
-			str_size += tags.back().second.size();
-			for(auto it1 = param_xml_tag.begin(); it1 != param_xml_tag.end(); ++it1) {
-				tags.emplace_back(it1->first, writer.escape_str(it1->second.def));
-				for(auto it2 = it1->second.regexp.begin() ; it2 != it1->second.regexp.end(); ++it2) {
-					std::regex reg(it2->second, std::regex_constants::ECMAScript | std::regex_constants::icase);
-					if(std::regex_search((*it)->resolved, reg)) {
-						tags.back().second = writer.escape_str(it2->first);
-					}
-				}
-				str_size += tags.back().second.size();
-			}
-			if(j >= xml_entry_lim || (pos + wrap_length + tag_length + str_size > xml_filemb_lim * 1024 * 1024)) {
-				pos = 0;
-				j = 0;
-				i++;
-				writer.write_end_el();
-				writer.write_end_doc();
-				writer.flush();
-				sitemap_file.close();
-				file_name = sitemap_dir + "/" + xml_name + std::to_string(i) + ".xml";
-				sitemap_file.open(file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-				if(!sitemap_file.is_open()) {
-					throw std::runtime_error("Can not open " + file_name);
+			err = httplib::Error::SSLConnection;
+		} else {
+			c->state = Conn::state_t::send;
+			if(main_obj.cert_verification) {
+				c->verify_result = SSL_get_verify_result(c->ssl);
+				X509* cert = SSL_get_peer_certificate(c->ssl);
+				if(c->verify_result != X509_V_OK || !cert || X509_check_host(cert, c->host.data(), c->host.size(), 0, nullptr) != 1) {
+					err = httplib::Error::SSLServerVerification;
 				}
-				writer.write_start_doc();
-				writer.write_start_el("urlset");
-				writer.write_attr("xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
+				X509_free(cert);
 			}
-			if(!tag_length) {
-				outpos = sitemap_file.tellp();
-			}
-			writer.write_start_el("url");
-			for(auto it1 = tags.begin(); it1 != tags.end(); ++it1) {
-				writer.write_start_el(it1->first);
-				writer.write_str(it1->second, false);
-				writer.write_end_el();
+		}
+	}
+#endif
+	if(err == httplib::Error::Success && c->state == Conn::state_t::send) {
+		while(c->out_pos < c->out.size()) {
+			int r = io_write(c, c->out.data() + c->out_pos, c->out.size() - c->out_pos);
+			if(r == -2) {
+				return;
 			}
-			writer.write_end_el();
-			if(!tag_length) {
-				tag_length = sitemap_file.tellp() - outpos;
-				tag_length -= str_size;
-				tag_length -= 1;
+			if(r <= 0) {
+				err = httplib::Error::Write;
+				break;
 			}
-			pos += tag_length + str_size;
-			j++;
+			c->out_pos += r;
 		}
-		writer.write_end_el();
-		writer.write_end_doc();
-		writer.flush();
-		sitemap_file.close();
-		if(!xml_index_name.empty()) {
-			file_name = sitemap_dir + "/" + xml_index_name + ".xml";
-			sitemap_file.open(file_name, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-			if(!sitemap_file.is_open()) {
-				throw std::runtime_error("Can not open " + file_name);
+		if(err == httplib::Error::Success) {
+			c->state = Conn::state_t::recv;
+			c->deadline = clock_::now() + std::chrono::seconds(CPPHTTPLIB_READ_TIMEOUT_SECOND);
+			set_events(c, EPOLLIN);
+		}
+	}
+	if(err == httplib::Error::Success && c->state == Conn::state_t::recv) {
+		char buf[16384];
+		while(!finished && err == httplib::Error::Success) {
+			int r = io_read(c, buf, sizeof(buf));
+			if(r == -2) {
+				break;
 			}
-			writer.write_start_doc();
-			writer.write_start_el("sitemapindex");
-			writer.write_attr("xmlns", "http://www.sitemaps.org/schemas/sitemap/0.9");
-			writer.write_start_el("sitemap");
-			for(j = 1; j <= i; j++) {
-				writer.write_start_el("loc");
-				writer.write_str(base + xml_name + std::to_string(j) + ".xml");
-				writer.write_end_el();
+			if(r < 0) {
+				err = httplib::Error::Read;
+			} else if(r == 0) {
+				if(c->head_done && c->body == Conn::body_t::close) {
+					finished = true;
+				} else {
+					err = httplib::Error::Read;
+				}
+			} else {
+				c->read_any = true;
+				c->deadline = clock_::now() + std::chrono::seconds(CPPHTTPLIB_READ_TIMEOUT_SECOND);
+				finished = consume(c, buf, r, err);
 			}
-			writer.write_end_el();
-			writer.write_end_el();
-			writer.write_end_doc();
-			writer.flush();
-			sitemap_file.close();
 		}
 	}
-}
-
-void Thread::start() {
-	p.set_callback([this](html::node& n) {
-		if(n.type_node != html::node_t::tag || n.type_tag != html::tag_t::open) {
+	if(err != httplib::Error::Success) {
+		if(c->reused && !c->read_any) {
+			// a pooled connection went stale, try once more with a new one
+			auto url = c->url;
+			active--;
+			close(c);
+			begin(url, false);
 			return;
 		}
-		if(n.tag_name == "base") {
-			auto href = n.get_attr("href");
-			if(!href.empty()) {
-				m_url->base_href = href;
+		fail(c, err);
+		return;
+	}
+	if(finished) {
+		complete(c);
+	}
+}
+
+bool Fetch_engine::consume(Conn* c, const char* data, size_t size, httplib::Error& err) {
+	if(c->head_done) {
+		return feed_body(c, data, size, err);
+	}
+	c->in.append(data, size);
+	while(true) {
+		auto pos = c->in.find("\r\n\r\n");
+		if(pos == std::string::npos) {
+			if(c->in.size() > CPPHTTPLIB_HEADER_MAX_LENGTH * 8) {
+				err = httplib::Error::Read;
 			}
-			return;
+			return false;
 		}
-		if(std::find(Tags_main.begin(), Tags_main.end(), n.tag_name) != Tags_main.end()) {
-			auto href = n.get_attr("href");
-			if(!href.empty()) {
-				std::unique_ptr<Url_struct> url(new Url_struct);
-				url->found = href;
-				url->handle = url_handle_t::query_parse;
-				set_url(url);
-			}
-			return;
+		if(!parse_head(c, pos)) {
+			err = httplib::Error::Read;
+			return false;
 		}
-		if(main_obj.link_check) {
-			for(auto& tag : Tags_other) {
-				if(n.tag_name == tag.name) {
-					for(auto& attr : tag.attr) {
-						auto href = n.get_attr(attr.name);
-						if(href.empty()) {
-							continue;
-						}
-						if(attr.pre && !attr.pre(n, href, this)) {
-							continue;
-						}
-						std::unique_ptr<Url_struct> url(new Url_struct);
-						url->found = href;
-						url->handle = url_handle_t::query;
-						set_url(url);
-					}
-					return;
-				}
-			}
+		c->in.erase(0, pos + 4);
+		// skip interim responses (100 Continue etc.)
+		if(c->res->status < 200) {
+			c->res.reset(new httplib::Response);
+			continue;
 		}
-	});
-	if(main_obj.param_log_bad_html) {
-		p.set_callback([this](html::err_t e, html::node& n) {
-			std::string msg;
-			if(e == html::err_t::tag_not_closed) {
-				html::node* current = &n;
-				while(current->get_parent()) {
-					msg.insert(0, " " + current->tag_name);
-					current = current->get_parent();
-				}
-				msg.insert(0, "Unclosed tag:");
-			}
-			if(main_obj.log_bad_html_file) {
-				main_obj.log_bad_html_file.write({msg, std::to_string(m_url->id)});
-			}
-			if(main_obj.log_bad_html_console) {
-				main_obj.log_bad_html_console.write({msg, m_url->resolved});
-			}
-		});
+		break;
 	}
-	uthread.reset(new std::thread(&Thread::load, this));
-}
-
-void Thread::join() {
-	if(uthread != nullptr) {
-		uthread->join();
-		uthread = nullptr;
+	c->head_done = true;
+	auto& res = *c->res;
+	auto connection = boost::to_lower_copy(res.get_header_value("Connection"));
+	if(res.version == "HTTP/1.0") {
+		c->keep_alive = connection.find("keep-alive") != std::string::npos;
+	} else {
+		c->keep_alive = connection.find("close") == std::string::npos;
+	}
+	if(c->head || res.status == 204 || res.status == 304) {
+		c->body = Conn::body_t::none;
+	} else if(boost::to_lower_copy(res.get_header_value("Transfer-Encoding")).find("chunked") != std::string::npos) {
+		c->body = Conn::body_t::chunked;
+	} else if(res.has_header("Content-Length")) {
+		c->body = Conn::body_t::length;
+		c->body_left = std::strtoull(res.get_header_value("Content-Length").c_str(), nullptr, 10);
+		if(!c->body_left) {
+			c->body = Conn::body_t::none;
+		}
+	} else {
+		c->body = Conn::body_t::close;
+		c->keep_alive = false;
+	}
+	if(c->body == Conn::body_t::none) {
+		return true;
 	}
+	handler.m_url = c->url;
+	handler.verify_result = c->verify_result;
+	std::swap(handler.page, c->page);
+	handler.http_headers(res);
+	std::swap(handler.page, c->page);
+	std::string rest;
+	rest.swap(c->in);
+	if(c->body == Conn::body_t::chunked) {
+		c->in.swap(rest);
+		return feed_chunked(c, err);
+	}
+	return feed_body(c, rest.data(), rest.size(), err);
 }
 
-void Thread::load() {
-	try {
-		{
-			std::lock_guard<std::mutex> lk(main_obj.mutex);
-			main_obj.thread_work++;
+bool Fetch_engine::parse_head(Conn* c, size_t end) {
+	auto& res = *c->res;
+	size_t pos = 0;
+	bool first = true;
+	while(pos < end) {
+		auto eol = c->in.find("\r\n", pos);
+		if(eol == std::string::npos || eol > end) {
+			eol = end;
 		}
-		while(main_obj.get_url(this)) {
-			if(suspend) {
-				continue;
-			}
-#ifndef CPPHTTPLIB_OPENSSL_SUPPORT
-			if(m_url->ssl) {
-				if(main_obj.log_error_reply_file) {
-					main_obj.log_error_reply_file.write({"HTTPS not supported", m_url->resolved, std::to_string(m_url->parent)});
-				}
-				if(main_obj.log_error_reply_console) {
-					main_obj.log_error_reply_console.write({"HTTPS not supported", m_url->resolved, main_obj.get_resolved(m_url->parent)});
-				}
-				continue;
-			}
-#endif
-			std::string scheme_host(m_url->ssl ? "https" : "http");
-			scheme_host += "://" + m_url->host;
-			cli = std::make_shared<httplib::Client>(scheme_host);
-			if(!main_obj.param_interface.empty()) {
-				cli->set_interface(main_obj.param_interface.data());
-			}
-			if(m_url->ssl) {
-				cli->enable_server_certificate_verification(main_obj.cert_verification);
-				if(main_obj.cert_verification) {
-					if(!main_obj.ca_cert_file_path.empty()) {
-						cli->set_ca_cert_path(main_obj.ca_cert_file_path.c_str());
-					}
-					if(!main_obj.ca_cert_dir_path.empty()) {
-						cli->set_ca_cert_path(nullptr, main_obj.ca_cert_dir_path.c_str());
-					}
-				}
+		std::string line = c->in.substr(pos, eol - pos);
+		pos = eol + 2;
+		if(first) {
+			first = false;
+			if(line.compare(0, 5, "HTTP/")) {
+				return false;
 			}
-			Timer tmr;
-			if(m_url->handle == url_handle_t::query_parse) {
-				result = std::make_shared<httplib::Result>(cli->Get(m_url->path.c_str()));
-			} else {
-				result = std::make_shared<httplib::Result>(cli->Head(m_url->path.c_str()));
+			auto sp = line.find(' ');
+			if(sp == std::string::npos) {
+				return false;
 			}
-			double time = tmr.seconds();
-			m_url->time += time;
-			m_url->try_cnt++;
-			if(main_obj.log_info_console) {
-				main_obj.log_info_console.write({std::to_string(id), std::to_string(time), m_url->resolved, main_obj.get_resolved(m_url->parent)});
-			}
-			http_finished();
-			if(main_obj.param_sleep) {
-				std::this_thread::sleep_for(std::chrono::milliseconds(main_obj.param_sleep));
+			res.version = line.substr(0, sp);
+			res.status = std::atoi(line.c_str() + sp + 1);
+			auto sp2 = line.find(' ', sp + 1);
+			if(sp2 != std::string::npos) {
+				res.reason = line.substr(sp2 + 1);
 			}
+			continue;
 		}
-	} catch(...) {
-		{
-			std::lock_guard<std::mutex> lk(main_obj.mutex);
-			exc_ptr = std::current_exception();
-			main_obj.running = false;
+		auto colon = line.find(':');
+		if(colon == std::string::npos) {
+			continue;
 		}
-		main_obj.cond.notify_all();
+		res.headers.emplace(boost::trim_copy(line.substr(0, colon)), boost::trim_copy(line.substr(colon + 1)));
 	}
+	return !first && res.status > 0;
 }
 
-void Thread::http_finished() {
-	auto& reply = *result;
-	if(!reply) {
-		if(m_url->try_cnt < main_obj.try_limit) {
-			main_obj.try_again(m_url);
-		} else {
-			m_url->error = httplib::to_string(reply.error());
-			if(main_obj.log_error_reply_file) {
-				main_obj.log_error_reply_file.write({m_url->error, m_url->resolved, std::to_string(m_url->parent)});
-			}
-			if(main_obj.log_error_reply_console) {
-				main_obj.log_error_reply_console.write({m_url->error, m_url->resolved, main_obj.get_resolved(m_url->parent)});
-			}
-		}
-		return;
+bool Fetch_engine::feed_body(Conn* c, const char* data, size_t size, httplib::Error& err) {
+	if(c->body == Conn::body_t::length) {
+		auto take = std::min(size, c->body_left);
+		body_data(c, data, take);
+		c->body_left -= take;
+		return !c->body_left;
 	}
-	if(m_url->ssl) {
-		auto res = cli->get_openssl_verify_result();
-		if(res != X509_V_OK) {
-			m_url->error = std::string("Certificate verification error: ") + X509_verify_cert_error_string(res);
-			if(main_obj.log_error_reply_file) {
-				main_obj.log_error_reply_file.write({m_url->error, m_url->resolved, std::to_string(m_url->parent)});
-			}
-			if(main_obj.log_error_reply_console) {
-				main_obj.log_error_reply_console.write({m_url->error, m_url->resolved, main_obj.get_resolved(m_url->parent)});
-			}
-			return;
-		}
+	if(c->body == Conn::body_t::chunked) {
+		c->in.append(data, size);
+		return feed_chunked(c, err);
 	}
-	if(reply->status >= 500 && reply->status < 600 && m_url->try_cnt < main_obj.try_limit) {
-		main_obj.try_again(m_url);
+	body_data(c, data, size);
+	return false;
+}
+
+// Body bytes go to the page parser of the connection or are kept in the response.
+void Fetch_engine::body_data(Conn* c, const char* data, size_t size) {
+	if(!c->page.active) {
+		c->res->body.append(data, size);
 		return;
 	}
-	if(reply->status >= 300 && reply->status < 400) {
-		m_url->error = "Redirect";
-		if(main_obj.log_redirect_file) {
-			main_obj.log_redirect_file.write({m_url->resolved, std::to_string(m_url->parent)});
-		}
-		if(main_obj.log_redirect_console) {
-			main_obj.log_redirect_console.write({m_url->resolved, main_obj.get_resolved(m_url->parent)});
-		}
-		if(m_url->redirect_cnt > main_obj.redirect_limit) {
-			if(main_obj.log_error_reply_file) {
-				main_obj.log_error_reply_file.write({"Redirect limit reached", m_url->resolved, std::to_string(m_url->parent)});
+	handler.m_url = c->url;
+	std::swap(handler.page, c->page);
+	handler.http_body(data, size);
+	std::swap(handler.page, c->page);
+}
+
+bool Fetch_engine::feed_chunked(Conn* c, httplib::Error& err) {
+	auto& in = c->in;
+	while(true) {
+		if(c->chunk_data) {
+			auto take = std::min(in.size() - c->in_pos, c->body_left);
+			body_data(c, in.data() + c->in_pos, take);
+			c->in_pos += take;
+			c->body_left -= take;
+			if(c->body_left || in.size() - c->in_pos < 2) {
+				break;
 			}
-			if(main_obj.log_error_reply_console) {
-				main_obj.log_error_reply_console.write({"Redirect limit reached", m_url->resolved, main_obj.get_resolved(m_url->parent)});
+			if(in.compare(c->in_pos, 2, "\r\n")) {
+				err = httplib::Error::Read;
+				return false;
 			}
-			return;
+			c->in_pos += 2;
+			c->chunk_data = false;
+			continue;
 		}
-		if(reply->has_header("Location")) {
-			std::unique_ptr<Url_struct> url(new Url_struct);
-			url->found = reply->get_header_value("Location");
-			url->handle = url_handle_t::query_parse;
-			url->redirect_cnt = m_url->redirect_cnt + 1;
-			set_url(url);
+		auto eol = in.find("\r\n", c->in_pos);
+		if(eol == std::string::npos) {
+			break;
 		}
-		return;
-	}
-	if(reply->status != 200) {
-		m_url->error = "Code:" + std::to_string(reply->status);
-		if(main_obj.log_error_reply_file) {
-			main_obj.log_error_reply_file.write({m_url->error, m_url->resolved, std::to_string(m_url->parent)});
+		std::string line = in.substr(c->in_pos, eol - c->in_pos);
+		c->in_pos = eol + 2;
+		if(c->chunk_last) {
+			// trailers end with an empty line
+			if(line.empty()) {
+				return true;
+			}
+			continue;
 		}
-		if(main_obj.log_error_reply_console) {
-			main_obj.log_error_reply_console.write({m_url->error, m_url->resolved, main_obj.get_resolved(m_url->parent)});
+		char* end = nullptr;
+		c->body_left = std::strtoull(line.c_str(), &end, 16);
+		if(end == line.c_str()) {
+			err = httplib::Error::Read;
+			return false;
 		}
-		return;
-	}
-	if(m_url->handle == url_handle_t::query) {
-		return;
-	}
-	if(!reply->has_header("Content-Type")) {
-		m_url->error = "Content-Type empty";
-		if(main_obj.log_error_reply_file) {
-			main_obj.log_error_reply_file.write({m_url->error, m_url->resolved, std::to_string(m_url->parent)});
+		if(c->body_left) {
+			c->chunk_data = true;
+		} else {
+			c->chunk_last = true;
 		}
-		if(main_obj.log_error_reply_console) {
-			main_obj.log_error_reply_console.write({m_url->error, m_url->resolved, main_obj.get_resolved(m_url->parent)});
+	}
+	in.erase(0, c->in_pos);
+	c->in_pos = 0;
+	return false;
+}
+
+void Fetch_engine::complete(Conn* c) {
+	active--;
+	auto url = c->url;
+	auto res = std::move(c->res);
+	auto page = std::move(c->page);
+	auto verify_result = c->verify_result;
+	double time = c->timer.seconds();
+	if(c->keep_alive && main_obj.keep_alive && main_obj.pool_host_limit) {
+		c->state = Conn::state_t::idle;
+		c->url = nullptr;
+		c->deadline = clock_::now() + std::chrono::seconds(main_obj.pool_idle_timeout);
+		set_events(c, EPOLLIN);
+		auto& list = idle[c->key];
+		if(list.size() >= main_obj.pool_host_limit) {
+			close(list.front());
 		}
-		return;
+		list.push_back(c);
+	} else {
+		close(c);
 	}
-	// check html
-	auto content_type = reply->get_header_value("Content-Type");
-	if(content_type.find("text/html") == std::string::npos) {
-		return;
+	done(url, time, std::move(res), httplib::Error::Success, verify_result, std::move(page));
+}
+
+void Fetch_engine::fail(Conn* c, httplib::Error err) {
+	active--;
+	auto url = c->url;
+	double time = c->timer.seconds();
+	close(c);
+	done(url, time, nullptr, err, 0);
+}
+
+void Fetch_engine::done(Url_struct* url, double time, std::unique_ptr<httplib::Response> res, httplib::Error err, long verify_result, Thread::Page&& page) {
+	handler.m_url = url;
+	handler.verify_result = verify_result;
+	handler.page = std::move(page);
+	handler.result = std::make_shared<httplib::Result>(std::move(res), err);
+	handler.request_finished(time);
+	main_obj.release_url(url);
+}
+
+void Fetch_engine::close(Conn* c) {
+	if(c->state == Conn::state_t::idle) {
+		auto& list = idle[c->key];
+		list.erase(std::remove(list.begin(), list.end(), c), list.end());
 	}
-	m_url->is_html = true;
-	// charset from header
-	auto pos = content_type.find("charset=");
-	if(pos != std::string::npos) {
-		m_url->charset = content_type.substr(pos + 8);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	if(c->ssl) {
+		SSL_free(c->ssl);
 	}
-	p.parse(reply->body);
+#endif
+	::close(c->fd);
+	// events for this connection may still be pending in the current batch
+	auto it = conns.find(c);
+	closed.push_back(std::move(it->second));
+	conns.erase(it);
 }
 
-void Thread::set_url(std::unique_ptr<Url_struct>& new_url) {
-	new_url->parent = m_url->id;
-	new_url->base_href = m_url->base_href;
-	if(main_obj.handle_url(new_url.get())) {
-		main_obj.set_url(new_url);
-	} else {
-		if(main_obj.log_ignored_url_file) {
-			main_obj.log_ignored_url_file.write({new_url->found, std::to_string(new_url->parent)});
+void Fetch_engine::check_timeouts() {
+	auto now = clock_::now();
+	if(now - last_check < std::chrono::milliseconds(100)) {
+		return;
+	}
+	last_check = now;
+	std::vector<Conn*> expired;
+	for(auto& conn : conns) {
+		if(conn.second->deadline < now) {
+			expired.push_back(conn.first);
 		}
-		if(main_obj.log_ignored_url_console) {
-			main_obj.log_ignored_url_console.write({new_url->found, main_obj.get_resolved(new_url->parent)});
+	}
+	for(auto c : expired) {
+		if(!conns.count(c)) {
+			continue;
+		}
+		if(c->state == Conn::state_t::idle) {
+			close(c);
+		} else if(c->state == Conn::state_t::recv) {
+			fail(c, httplib::Error::Read);
+		} else if(c->state == Conn::state_t::send) {
+			fail(c, httplib::Error::Write);
+		} else {
+			fail(c, httplib::Error::Connection);
 		}
 	}
 }
 
-bool Handler::attr_charset(html::node& n, std::string& href, Thread* t) {
-	if(t->m_url->charset.empty()) {
-		if(boost::to_lower_copy(n.get_attr("http-equiv")) == "content-type") {
+void Fetch_engine::abort_all() {
+	while(!conns.empty()) {
+		close(conns.begin()->first);
+	}
+	active = 0;
+}
+#endif
+
+bool Handler::attr_charset(const Tag_attrs& n, std::string& href, Thread* t) {
+	if(!t->m_url->charset) {
+		if(boost::to_lower_copy(n.get("http-equiv")) == "content-type") {
 			auto pos = href.find("charset=");
 			if(pos != std::string::npos) {
-				t->m_url->charset = href.substr(pos + 8);
+				t->m_url->charset = main_obj.charsets.add(href.substr(pos + 8));
 			}
 		}
 	}
 	return false;
 }
 
-bool Handler::attr_refresh(html::node& n, std::string& href, Thread* t) {
-	if(t->m_url->charset.empty()) {
-		if(boost::to_lower_copy(n.get_attr("http-equiv")) == "refresh") {
-			std::regex e("[\\d\\s]+;\\s*url\\s*=\\s*(.+)", std::regex_constants::ECMAScript | std::regex_constants::icase);
+bool Handler::attr_refresh(const Tag_attrs& n, std::string& href, Thread* t) {
+	if(!t->m_url->charset) {
+		if(boost::to_lower_copy(n.get("http-equiv")) == "refresh") {
+			static const std::regex e("[\\d\\s]+;\\s*url\\s*=\\s*(.+)", std::regex_constants::ECMAScript | std::regex_constants::icase | std::regex_constants::optimize);
 			std::smatch m;
 			if(std::regex_match(href, m, e)) {
-				std::unique_ptr<Url_struct> url(new Url_struct);
-				url->found = m[1];
-				url->handle = url_handle_t::query_parse;
+				Url_new url;
+				url.found = m[1];
+				url.handle = url_handle_t::query_parse;
 				t->set_url(url);
 			}
 		}
@@ -1127,16 +4824,16 @@ bool Handler::attr_refresh(html::node& n, std::string& href, Thread* t) {
 	return false;
 }
 
-bool Handler::attr_srcset(html::node& n, std::string& href, Thread* t) {
+bool Handler::attr_srcset(const Tag_attrs&, std::string& href, Thread* t) {
 	str_vec src_all;
 	boost::split(src_all, href, boost::is_any_of(","));
 	for(auto v : src_all) {
 		str_vec src;
 		boost::split(src, v, boost::is_any_of(" "));
 		if(!src.empty()) {
-			std::unique_ptr<Url_struct> url(new Url_struct);
-			url->found = src[0];
-			url->handle = url_handle_t::query;
+			Url_new url;
+			url.found = src[0];
+			url.handle = url_handle_t::query;
 			t->set_url(url);
 		}
 	}
@@ -1188,6 +4885,85 @@ bool handle_exit() {
 
 }
 
+void Hash128::block(const char* data) {
+	uint64_t k1, k2;
+	std::memcpy(&k1, data, 8);
+	std::memcpy(&k2, data + 8, 8);
+	k1 *= murmur_c1;
+	k1 = rotl64(k1, 31);
+	k1 *= murmur_c2;
+	h1 ^= k1;
+	h1 = rotl64(h1, 27);
+	h1 += h2;
+	h1 = h1 * 5 + 0x52dce729;
+	k2 *= murmur_c2;
+	k2 = rotl64(k2, 33);
+	k2 *= murmur_c1;
+	h2 ^= k2;
+	h2 = rotl64(h2, 31);
+	h2 += h1;
+	h2 = h2 * 5 + 0x38495ab5;
+}
+
+void Hash128::update(const char* data, size_t n) {
+	size += n;
+	if(tail_size) {
+		size_t take = std::min(n, 16 - tail_size);
+		std::memcpy(tail + tail_size, data, take);
+		tail_size += take;
+		data += take;
+		n -= take;
+		if(tail_size < 16) {
+			return;
+		}
+		block(tail);
+		tail_size = 0;
+	}
+	for(; n >= 16; data += 16, n -= 16) {
+		block(data);
+	}
+	std::memcpy(tail, data, n);
+	tail_size = n;
+}
+
+Fingerprint Hash128::digest() const {
+	auto t = reinterpret_cast<const unsigned char*>(tail);
+	uint64_t a = h1;
+	uint64_t b = h2;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	for(size_t i = tail_size; i > 8; i--) {
+		k2 ^= static_cast<uint64_t>(t[i - 1]) << ((i - 9) * 8);
+	}
+	if(tail_size > 8) {
+		k2 *= murmur_c2;
+		k2 = rotl64(k2, 33);
+		k2 *= murmur_c1;
+		b ^= k2;
+	}
+	for(size_t i = std::min<size_t>(tail_size, 8); i > 0; i--) {
+		k1 ^= static_cast<uint64_t>(t[i - 1]) << ((i - 1) * 8);
+	}
+	if(tail_size) {
+		k1 *= murmur_c1;
+		k1 = rotl64(k1, 31);
+		k1 *= murmur_c2;
+		a ^= k1;
+	}
+	a ^= size;
+	b ^= size;
+	a += b;
+	b += a;
+	a = fmix64(a);
+	b = fmix64(b);
+	a += b;
+	b += a;
+	Fingerprint fp;
+	fp.hi = b;
+	fp.lo = a;
+	return fp;
+}
+
 namespace utils {
 
 bool file_exists(const std::string& str) {
@@ -1195,30 +4971,196 @@ bool file_exists(const std::string& str) {
    return fs.is_open();
 }
 
+Fingerprint hash128(const char* data, size_t size) {
+	Hash128 h;
+	h.update(data, size);
+	return h.digest();
 }
 
-int main(int argc, char *argv[]) {
-	try {
-		if(argc != 2) {
-			throw std::runtime_error("Usage: " + std::string(argv[0]) + " setting.conf");
+// Seconds since the epoch from an IMF-fixdate such as
+// "Sun, 06 Nov 1994 08:49:37 GMT".
+bool parse_http_date(const std::string& str, int64_t& t) {
+	static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+	char mon[4] = {};
+	int d, y, hh, mm, ss;
+	if(std::sscanf(str.c_str(), "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &d, mon, &y, &hh, &mm, &ss) != 6) {
+		return false;
+	}
+	int m = 0;
+	while(m < 12 && std::strcmp(months[m], mon)) {
+		m++;
+	}
+	if(m == 12) {
+		return false;
+	}
+	// days from civil, the date is UTC so timegm is not needed
+	m++;
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int64_t yoe = y - era * 400;
+	int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = era * 146097 + doe - 719468;
+	t = days * 86400 + hh * 3600 + mm * 60 + ss;
+	return true;
+}
+
+// Seconds from a Retry-After value, either delta-seconds or an HTTP date.
+// -1 if not valid.
+int retry_after(const std::string& str) {
+	if(str.empty()) {
+		return -1;
+	}
+	if(std::all_of(str.begin(), str.end(), [](char c) {
+		return c >= '0' && c <= '9';
+	})) {
+		return str.size() > 9 ? INT32_MAX : std::stoi(str);
+	}
+	int64_t t;
+	if(!parse_http_date(str, t)) {
+		return -1;
+	}
+	int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	return static_cast<int>(std::min<int64_t>(std::max<int64_t>(t - now, 0), INT32_MAX));
+}
+
+// W3C datetime used by sitemaps, e.g. "1994-11-06T08:49:37+00:00".
+std::string w3c_date(int64_t t) {
+	int64_t days = (t >= 0 ? t : t - 86399) / 86400;
+	int64_t sec = t - days * 86400;
+	// civil from days
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	int64_t doe = days - era * 146097;
+	int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64_t mp = (5 * doy + 2) / 153;
+	int64_t d = doy - (153 * mp + 2) / 5 + 1;
+	int64_t m = mp < 10 ? mp + 3 : mp - 9;
+	int64_t y = yoe + era * 400 + (m <= 2);
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d+00:00", static_cast<int>(y), static_cast<int>(m), static_cast<int>(d), static_cast<int>(sec / 3600), static_cast<int>(sec / 60 % 60), static_cast<int>(sec % 60));
+	return buf;
+}
+
+// First of > " ' in [p, end), or end.
+const char* find_tag_end(const char* p, const char* end) {
+#ifdef __SSE2__
+	const __m128i gt = _mm_set1_epi8('>');
+	const __m128i quot = _mm_set1_epi8('"');
+	const __m128i apos = _mm_set1_epi8('\'');
+	while(end - p >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, apos)));
+		int mask = _mm_movemask_epi8(m);
+		if(mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	for(; p < end; p++) {
+		if(*p == '>' || *p == '"' || *p == '\'') {
+			return p;
+		}
+	}
+	return end;
+}
+
+// Character references of an attribute value replaced by their UTF-8 text.
+// Named references other than the common ones and references without ';'
+// are kept as written.
+std::string decode_refs(const std::string& str) {
+	auto amp = str.find('&');
+	if(amp == std::string::npos) {
+		return str;
+	}
+	static const std::pair<const char*, const char*> names[] = {
+		{"amp", "&"}, {"lt", "<"}, {"gt", ">"}, {"quot", "\""}, {"apos", "'"}, {"nbsp", "\xC2\xA0"}
+	};
+	std::string ret(str, 0, amp);
+	size_t i = amp;
+	while(i < str.size()) {
+		if(str[i] != '&') {
+			ret += str[i++];
+			continue;
+		}
+		auto semi = str.find(';', i + 1);
+		if(semi == std::string::npos || semi - i > 10) {
+			ret += str[i++];
+			continue;
+		}
+		std::string ref(str, i + 1, semi - i - 1);
+		bool done = false;
+		if(ref.size() > 1 && ref[0] == '#') {
+			bool hex = ref[1] == 'x' || ref[1] == 'X';
+			const char* digits = hex ? "0123456789abcdefABCDEF" : "0123456789";
+			size_t start = hex ? 2 : 1;
+			if(start < ref.size() && ref.find_first_not_of(digits, start) == std::string::npos) {
+				uint32_t cp = static_cast<uint32_t>(std::strtoul(ref.c_str() + start, nullptr, hex ? 16 : 10));
+				if(!cp || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+					cp = 0xFFFD;
+				}
+				if(cp < 0x80) {
+					ret += static_cast<char>(cp);
+				} else if(cp < 0x800) {
+					ret += static_cast<char>(0xC0 | cp >> 6);
+					ret += static_cast<char>(0x80 | (cp & 0x3F));
+				} else if(cp < 0x10000) {
+					ret += static_cast<char>(0xE0 | cp >> 12);
+					ret += static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+					ret += static_cast<char>(0x80 | (cp & 0x3F));
+				} else {
+					ret += static_cast<char>(0xF0 | cp >> 18);
+					ret += static_cast<char>(0x80 | (cp >> 12 & 0x3F));
+					ret += static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+					ret += static_cast<char>(0x80 | (cp & 0x3F));
+				}
+				done = true;
+			}
+		} else {
+			for(const auto& name : names) {
+				if(ref == name.first) {
+					ret += name.second;
+					done = true;
+					break;
+				}
+			}
 		}
-		Timer tmr;
-		main_obj.import_param(argv[1]);
-		main_obj.start();
-		if(exc_ptr) {
-			std::rethrow_exception(exc_ptr);
+		if(done) {
+			i = semi + 1;
+		} else {
+			ret += str[i++];
 		}
-		main_obj.finished();
-		auto elapsed_str = "Elapsed time: " + tmr.elapsed_str();
-		std::cout << elapsed_str << std::endl;
-		if(main_obj.log_other) {
-			main_obj.log_other.write({elapsed_str});
+	}
+	return ret;
+}
+
+// First of & ' < > " in [p, end), or end.
+const char* find_xml_special(const char* p, const char* end) {
+#ifdef __SSE2__
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i apos = _mm_set1_epi8('\'');
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i gt = _mm_set1_epi8('>');
+	const __m128i quot = _mm_set1_epi8('"');
+	while(end - p >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, apos)), _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)), _mm_cmpeq_epi8(v, quot)));
+		int mask = _mm_movemask_epi8(m);
+		if(mask) {
+			return p + __builtin_ctz(mask);
 		}
-	} catch (const std::exception& e) {
-		std::cout << e.what() << std::endl;
-		if(main_obj.log_other) {
-			main_obj.log_other.write({e.what()});
+		p += 16;
+	}
+#endif
+	for(; p < end; p++) {
+		switch(*p) {
+			case '&': case '\'': case '<': case '>': case '"':
+				return p;
 		}
 	}
-	return 0;
-}
\ No newline at end of file
+	return end;
+}
+
+}
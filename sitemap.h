@@ -5,8 +5,11 @@
 #include <sstream>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <atomic>
 #include <stack>
 #include <mutex>
 #include <condition_variable>
@@ -14,23 +17,46 @@
 #include <functional>
 #include <algorithm>
 #include <chrono>
+#include <random>
 #include <iterator>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
 
 #include <boost/url.hpp>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 #include "deps/http/httplib.h"
 #include "deps/parser/html.hpp"
+#include "info_db.h"
+#include <zlib.h>
 
 #if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
 #define WINDOWS_PLATFORM
 #include <Windows.h>
+#include <io.h>
 #elif defined(macintosh) || defined(__APPLE__) || defined(__APPLE_CC__)
 #define MACOS_PLATFORM
 #include <signal.h>
 #elif defined(linux) || defined(__linux) || defined(__linux__)
 #define LINUX_PLATFORM
 #include <signal.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <sys/epoll.h>
+#endif
+
+#ifndef WINDOWS_PLATFORM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
 #endif
 
 using str_vec = std::vector<std::string>;
@@ -62,9 +88,11 @@ public:
 	void write_end_el();
 	void write_attr(const std::string&, const std::string&);
 	void write_str(const std::string&, bool escape = true);
-	std::string escape_str(std::string);
+	static std::string escape_str(const std::string&);
 	void flush();
 private:
+	void write_escaped(const std::string&);
+	void write_indent(int);
 	std::stack<std::string> open_tags;
 	std::ostream& output;
 	bool cur_tag_unclosed = false;
@@ -76,7 +104,7 @@ private:
 class CSV_Writer {
 public:
 	CSV_Writer(std::ostream& stream, std::string);
-	CSV_Writer& add(std::string);
+	CSV_Writer& add(const std::string&);
 	CSV_Writer& add(const char *str);
 	CSV_Writer& add(char *str);
 	template<typename T> CSV_Writer& add(T str);
@@ -92,15 +120,16 @@ class Main;
 
 class Log {
 public:
-	enum Field: int {id, found, url, parent, id_parent, time, is_html, try_cnt, charset, msg, thread, cnt};
+	enum Field: int {id, found, url, parent, id_parent, time, is_html, try_cnt, charset, msg, thread, cnt, duplicate};
 	virtual void write(const std::vector<std::string>&) = 0;
 	Log(const std::string&, const std::string&, const std::vector<Field>&);
 	virtual ~Log();
 protected:
+	std::vector<char> buffer;
 	std::ofstream file;
 	std::string file_name;
 	const std::vector<Field> fields;
-	const std::vector<std::string> fields_all{"id", "found", "url", "parent", "id_parent", "time", "is_html", "try_cnt", "charset", "msg", "thread", "cnt"};
+	const std::vector<std::string> fields_all{"id", "found", "url", "parent", "id_parent", "time", "is_html", "try_cnt", "charset", "msg", "thread", "cnt", "duplicate"};
 };
 
 class Console_Log: public Log {
@@ -132,46 +161,729 @@ public:
 	operator bool() const {
 		return enabled;
 	}
-	void write(const std::vector<std::string>&) const;
+	void write(std::vector<std::string>) const;
 private:
+	friend class Log_queue;
+	void write_now(const std::vector<std::string>&) const;
 	std::vector<std::unique_ptr<Log>> logs;
 	bool enabled = false;
 };
 
+// Bounded MPSC ring of log messages written by a background thread which
+// sleeps while the ring is empty. After stop messages are written by the
+// caller, in order after the queued ones.
+class Log_queue {
+public:
+	enum overflow_t {block, drop, count};
+	~Log_queue() {
+		stop();
+	}
+	void start(size_t, overflow_t);
+	bool push(const LogWrap*, std::vector<std::string>&);
+	void stop();
+	size_t get_dropped() const {
+		return dropped.load();
+	}
+private:
+	struct Cell {
+		std::atomic<size_t> seq;
+		const LogWrap* log = nullptr;
+		std::vector<std::string> msg;
+	};
+	bool queue(const LogWrap*, std::vector<std::string>&);
+	bool try_push(const LogWrap*, std::vector<std::string>&);
+	bool ready() const;
+	bool pop();
+	void loop();
+	std::unique_ptr<Cell[]> cells;
+	size_t mask = 0;
+	overflow_t overflow = block;
+	std::atomic<size_t> head{0};
+	size_t tail = 0;
+	std::atomic<bool> running{false};
+	std::atomic<bool> stopped{false};
+	// pushes in progress, stop waits for their cells to be published
+	std::atomic<size_t> producers{0};
+	std::atomic<bool> sleeping{false};
+	std::mutex mutex;
+	std::condition_variable cond;
+	// late messages are written while it is held
+	std::mutex mutex_stop;
+	std::atomic<size_t> dropped{0};
+	std::thread uthread;
+};
+
+// Values are stored escaped, regexes are shared between tags (Main::xml_tag_regex).
 struct Xml_tag {
-	std::vector<std::pair<std::string, std::string>> regexp;
+	std::vector<std::pair<std::string, size_t>> rules;
 	std::string def;
 };
 
-enum class url_handle_t {query, query_parse, none};
+enum class url_handle_t : uint8_t {query, query_parse, none};
 
-struct Url_struct {
+// View of a string stored in String_arena.
+struct Arena_str {
+	const char* data = nullptr;
+	uint32_t size = 0;
+	// block of the arena, in what was padding before
+	uint32_t block = 0;
+	std::string str() const {
+		return std::string(data, size);
+	}
+	operator std::string() const {
+		return str();
+	}
+	bool empty() const {
+		return !size;
+	}
+};
+
+// Storage for the strings of url records. A block is freed when all of its
+// strings are released, records are added in about the order they finish.
+// Not synchronized, guarded by Main::mutex.
+class String_arena {
+public:
+	Arena_str add(const std::string&);
+	void release(Arena_str&);
+	size_t mem_size() const;
+private:
+	struct Block {
+		std::unique_ptr<char[]> data;
+		size_t size;
+		size_t live;
+	};
+	static const size_t block_size = 1 << 20;
+	static const size_t no_block = SIZE_MAX;
+	void free(size_t);
+	std::vector<Block> blocks;
+	// block being filled
+	size_t current = no_block;
+	size_t block_used = block_size;
+	size_t mem = 0;
+};
+
+// Deduplicated small strings (hosts, charsets, errors) referenced by id.
+// Id 0 is the empty string.
+class String_table {
+public:
+	String_table() {
+		add("");
+	}
+	uint32_t add(const std::string&);
+	std::string get(uint32_t) const;
+	size_t size() const;
+	size_t mem_size() const;
+private:
+	std::deque<std::string> items;
+	std::unordered_map<std::string, uint32_t> index;
+	mutable std::mutex mutex;
+};
+
+// 128-bit hash of a normalized url.
+struct Fingerprint {
+	uint64_t hi = 0;
+	uint64_t lo = 0;
+	bool operator==(const Fingerprint& other) const {
+		return hi == other.hi && lo == other.lo;
+	}
+};
+
+struct Fingerprint_hash {
+	size_t operator()(const Fingerprint& fp) const {
+		return static_cast<size_t>(fp.lo);
+	}
+};
+
+// MurmurHash3 x64 128 of data given in pieces.
+class Hash128 {
+public:
+	void update(const char*, size_t);
+	Fingerprint digest() const;
+private:
+	void block(const char*);
+	uint64_t h1 = 0;
+	uint64_t h2 = 0;
+	char tail[16];
+	size_t tail_size = 0;
+	size_t size = 0;
+};
+
+struct Seen_slot {
+	uint64_t hi;
+	uint64_t lo;
+	uint32_t id;
+	uint32_t reserved;
+};
+
+// Read only view of a whole file, mapped where mmap is available and
+// read with one call otherwise.
+class File_map {
+public:
+	explicit File_map(const std::string&);
+	~File_map();
+	File_map(const File_map&) = delete;
+	File_map& operator=(const File_map&) = delete;
+	const char* data() const {
+		return ptr;
+	}
+	size_t size() const {
+		return len;
+	}
+private:
+	const char* ptr = nullptr;
+	size_t len = 0;
+#ifdef WINDOWS_PLATFORM
+	std::vector<char> content;
+#endif
+};
+
+// Open addressing table of Seen_set, a vector in memory or a sparse file
+// mapped into memory. The file is removed with the table.
+// Nothing writes to a table while it has readers.
+struct Seen_table {
+	explicit Seen_table(size_t);
+	Seen_table(const std::string&, size_t);
+	~Seen_table();
+	Seen_table(const Seen_table&) = delete;
+	Seen_table& operator=(const Seen_table&) = delete;
+	Seen_slot* slots = nullptr;
+	size_t size = 0;
+	std::atomic<int> readers{0};
+private:
+	std::vector<Seen_slot> mem;
+	std::string file_name;
+	int fd = -1;
+};
+
+// Slots of a Seen_set at the time it was taken, readable without a lock.
+// The table is not written while a snapshot holds it.
+class Seen_snapshot {
+public:
+	Seen_snapshot(std::shared_ptr<Seen_table>, std::vector<Seen_slot>);
+	Seen_snapshot(Seen_snapshot&&) = default;
+	~Seen_snapshot();
+	template<typename F> void each(F f) const {
+		for(const auto& slot : pending) {
+			f(slot);
+		}
+		for(size_t i = 0; table && i < table->size; i++) {
+			if(table->slots[i].id) {
+				f(table->slots[i]);
+			}
+		}
+	}
+private:
+	std::shared_ptr<Seen_table> table;
+	std::vector<Seen_slot> pending;
+};
+
+// Fingerprints of the urls seen during the crawl, mapped to the record index.
+// Without a directory the set is an open addressing table in memory. With a
+// directory the table is a file mapped into memory and a Bloom filter of
+// bounded size answers most negative lookups without touching it.
+// A disk table is doubled on a background thread, a table being read goes
+// unchanged and new slots wait in a small pending table meanwhile.
+// Not synchronized, guarded by Main::mutex.
+class Seen_set {
+public:
+	~Seen_set();
+	void init(const std::string&, size_t, size_t);
+	bool in_memory() const {
+		return dir.empty();
+	}
+	bool find(const Fingerprint&, uint32_t&);
+	void add(const Fingerprint&, uint32_t);
+	size_t size() const {
+		return cnt;
+	}
+	size_t mem_size() const;
+	std::string stats() const;
+	Seen_snapshot snapshot();
+	bool load(const char*, size_t);
+private:
+	using Slot = Seen_slot;
+	void bloom_add(uint64_t);
+	bool bloom_test(uint64_t) const;
+	static bool table_find(const Slot*, size_t, const Fingerprint&, uint32_t&);
+	static void table_insert(Slot*, size_t, const Slot&);
+	static void mem_insert(std::vector<Slot>&, const Slot&);
+	std::shared_ptr<Seen_table> create(size_t);
+	void update();
+	void grow();
+	void merge_pending();
+	std::shared_ptr<Seen_table> table;
+	std::shared_ptr<Seen_table> next;
+	std::vector<Slot> pending;
+	size_t pending_cnt = 0;
+	std::thread rehash;
+	std::atomic<bool> rehash_done{false};
+	int generation = 0;
+	std::string dir;
+	std::vector<uint64_t> bloom;
+	size_t bloom_k = 0;
+	size_t cnt = 0;
+	size_t cnt_absent = 0;
+	size_t cnt_fp = 0;
+};
+
+// Url found on a page, before it is resolved and deduplicated.
+struct Url_new {
 	std::string found;
 	std::string resolved;
-	std::string normalize;
-	std::string charset;
-	std::string path;
+	Fingerprint fingerprint;
 	std::string host;
-	std::string base_href;
-	bool is_html = false;
+	size_t path_pos = 0;
+	size_t path_len = 0;
+	bool ssl = false;
+	int parent = 0;
+	size_t redirect_cnt = 0;
+	url_handle_t handle = url_handle_t::query;
+};
+
+// Url record kept for the whole run. Strings are stored in arenas and
+// tables owned by Main, path is a part of resolved. Arena strings of a
+// finished record are released unless Main::keep_strings is set.
+struct Url_struct {
+	Arena_str found;
+	Arena_str resolved;
+	uint32_t path_pos = 0;
+	uint32_t path_len = 0;
+	uint32_t host = 0;
+	uint32_t charset = 0;
+	uint32_t error = 0;
 	int id = 0;
 	int parent = 0;
+	// id of the url with the same content
+	int duplicate = 0;
+	std::atomic<int> try_cnt{0};
+	// written under Main::mutex, read by the checkpoint without it
+	std::atomic<int> cnt{1};
 	double time = 0;
-	int try_cnt = 0;
+	uint8_t redirect_cnt = 0;
+	bool is_html = false;
 	bool ssl = false;
-	size_t redirect_cnt = 0;
 	url_handle_t handle = url_handle_t::query;
+	// links added by a try that failed in the middle of a streamed body
+	uint32_t links_sent = 0;
+	int64_t lastmod = 0;
+	// set when no more requests are made, fields above are final then
+	std::atomic<bool> done{false};
+	std::string path() const;
+};
+
+// Url records in fixed size blocks, addresses never change.
+// Writes are guarded by Main::mutex, published records can be read without a lock.
+class Url_store {
+public:
+	Url_store();
+	~Url_store();
+	Url_struct* add();
+	// makes the added records visible to size() and lock-free readers
+	void publish() {
+		published.store(cnt, std::memory_order_release);
+	}
+	Url_struct* operator[](size_t i) const {
+		return &blocks[i / block_size].load(std::memory_order_acquire)[i % block_size];
+	}
+	size_t size() const {
+		return published.load(std::memory_order_acquire);
+	}
+	size_t mem_size() const {
+		return block_cnt * block_size * sizeof(Url_struct) + max_blocks * sizeof(std::atomic<Url_struct*>);
+	}
+private:
+	static const size_t block_size = 16384;
+	static const size_t max_blocks = (static_cast<size_t>(INT32_MAX) + block_size) / block_size;
+	std::unique_ptr<std::atomic<Url_struct*>[]> blocks;
+	size_t block_cnt = 0;
+	size_t cnt = 0;
+	std::atomic<size_t> published{0};
+};
+
+// Filters from 'filters.filter' compiled into one pass over the url. Results do not
+// depend on rule order: exclude and skip regexes are joined into one pattern each,
+// include regexes must all match, get and ext rules are looked up in sets.
+class Filter {
+public:
+	void add(const std::string&);
+	void compile();
+	bool check(const boost::url&, bool&) const;
+private:
+	enum {exclude, include, skip, dir_cnt};
+	struct Rules {
+		str_vec patterns;
+		std::vector<std::regex> reg;
+		std::unordered_set<std::string> get;
+		std::unordered_set<std::string> ext;
+	};
+	Rules rules[dir_cnt];
+	bool has_get = false;
+	bool has_ext = false;
+};
+
+class Client_pool {
+public:
+	std::shared_ptr<httplib::Client> get(const Url_struct*);
+	void put(const Url_struct*, std::shared_ptr<httplib::Client>&, bool reuse = true);
+	void count(bool);
+	size_t get_cnt_new() const;
+	size_t get_cnt_reuse() const;
+private:
+	using clock_ = std::chrono::steady_clock;
+	struct Idle {
+		std::shared_ptr<httplib::Client> cli;
+		clock_::time_point time;
+	};
+	using Closed = std::vector<std::shared_ptr<httplib::Client>>;
+	std::string key(const Url_struct*) const;
+	void evict(clock_::time_point, Closed&);
+	std::shared_ptr<httplib::Client> create(const Url_struct*) const;
+	std::unordered_map<std::string, std::vector<Idle>> idle;
+	clock_::time_point last_evict = clock_::now();
+	size_t cnt_new = 0;
+	size_t cnt_reuse = 0;
+	mutable std::mutex mutex;
+};
+
+// Per-worker url deques. A worker takes urls from the front of its own
+// deque and steals from the back of the others when it runs dry.
+// With a host delay or limit set, urls are queued per host instead and
+// a host is handed out only when it is eligible: delay has passed since
+// its last request and less than limit requests to it are running.
+class Frontier {
+public:
+	using clock_ = std::chrono::steady_clock;
+	void init(size_t, int, size_t);
+	void push(Url_struct*, int);
+	Url_struct* pop(int);
+	void release(const Url_struct*);
+	bool empty() const {
+		return !cnt.load();
+	}
+	bool ready() const {
+		return polite ? ready_cnt.load() > 0 : !empty();
+	}
+	clock_::time_point next_due();
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Url_struct*> urls;
+	};
+	struct Host {
+		std::deque<Url_struct*> urls;
+		size_t active = 0;
+		clock_::time_point next;
+		bool queued = false;
+	};
+	using Due = std::pair<clock_::time_point, uint32_t>;
+	Url_struct* pop_host();
+	void schedule(uint32_t, clock_::time_point);
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::atomic<size_t> cnt{0};
+	std::atomic<size_t> next{0};
+	bool polite = false;
+	clock_::duration delay{};
+	size_t limit = 0;
+	std::mutex mutex;
+	std::vector<Host> hosts;
+	std::deque<uint32_t> ready_hosts;
+	std::priority_queue<Due, std::vector<Due>, std::greater<Due>> delayed;
+	std::atomic<size_t> ready_cnt{0};
+};
+
+// Failed urls waiting for their next try, ordered by due time.
+// Due urls are moved to the frontier by workers looking for work.
+class Retry_queue {
+public:
+	using clock_ = Frontier::clock_;
+	void push(Url_struct*, int, clock_::duration);
+	bool move_due(Frontier&);
+	bool empty() const {
+		return !cnt.load();
+	}
+	clock_::time_point next_due() const {
+		return clock_::time_point(clock_::duration(due.load()));
+	}
+private:
+	struct Item {
+		clock_::time_point time;
+		Url_struct* url;
+		int worker;
+		bool operator>(const Item& other) const {
+			return time > other.time;
+		}
+	};
+	std::priority_queue<Item, std::vector<Item>, std::greater<Item>> items;
+	std::mutex mutex;
+	std::atomic<size_t> cnt{0};
+	std::atomic<clock_::rep> due{clock_::time_point::max().time_since_epoch().count()};
+};
+
+// Fingerprints of html bodies: an exact hash and a 64-bit SimHash of word
+// shingles of the text, markup is left out. The SimHash is split into 4
+// bands of 16 bits, so a body within distance 3 shares at least one band
+// with the original. Every band is a table of buckets whose oldest entry
+// is replaced, memory stays bounded.
+class Content_index {
+public:
+	void init(size_t, int);
+	static uint64_t simhash(const char*, size_t, size_t&);
+	int find_add(const Fingerprint&, uint64_t, int, bool&);
+	// pages with fewer words outside the markup are not compared
+	static const size_t min_shingles = 16;
+	std::string stats() const;
+private:
+	struct Entry {
+		uint64_t exact;
+		uint64_t sim;
+		int32_t id;
+		uint32_t reserved;
+	};
+	static const size_t bands = 4;
+	std::vector<Entry> table;
+	std::vector<uint32_t> next;
+	size_t slots = 1;
+	int distance = 3;
+	std::mutex mutex;
+	size_t cnt = 0;
+	size_t cnt_exact = 0;
+	size_t cnt_near = 0;
+};
+
+// Incremental decoder of a response Content-Encoding. gzip and deflate
+// need CPPHTTPLIB_ZLIB_SUPPORT, br needs CPPHTTPLIB_BROTLI_SUPPORT.
+class Decoder {
+public:
+	using Output = std::function<void(const char*, size_t)>;
+	static const std::string& accepted();
+	bool init(const std::string&);
+	explicit operator bool() const {
+		return type != none;
+	}
+	bool feed(const char*, size_t, const Output&);
+	bool ended() const {
+		return end;
+	}
+private:
+	enum type_t {none, zlib, brotli};
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	struct Zlib_end {
+		void operator()(z_stream*) const;
+	};
+	std::unique_ptr<z_stream, Zlib_end> zs;
+	// input before the first output, replayed as raw deflate
+	std::string head;
+	bool first = true;
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	struct Brotli_end {
+		void operator()(BrotliDecoderState*) const;
+	};
+	std::unique_ptr<BrotliDecoderState, Brotli_end> br;
+#endif
+	type_t type = none;
+	bool end = false;
+};
+
+// Bytes of html bodies per host as received and after decoding.
+class Transfer_stats {
+public:
+	void add(uint32_t, uint64_t, uint64_t);
+	str_vec summary(const String_table&) const;
+private:
+	struct Bytes {
+		uint64_t wire = 0;
+		uint64_t body = 0;
+	};
+	std::vector<Bytes> hosts;
+	mutable std::mutex mutex;
+};
+
+// What is kept of an html page for the next run.
+struct Page_state {
+	std::string etag;
+	std::string last_modified;
+	std::string charset;
+	Fingerprint hash;
+	int64_t lastmod = 0;
+	// outlinks as [handle][uint32_t size][url]
+	std::string links;
+	void add_link(url_handle_t, const std::string&);
+};
+
+// Page states of the previous run stay in the mapped file, an index from
+// the hash of the url to the record offset is built on open and a state is
+// decoded when it is looked up. States of this run are appended to a new
+// file that replaces the old one when the crawl finishes.
+class Recrawl_store {
+public:
+	void open(const std::string&);
+	void close(bool);
+	operator bool() const {
+		return !file_name.empty();
+	}
+	bool find(const Url_struct*, Page_state&) const;
+	void add(const Url_struct*, const Page_state&);
+	void count_unchanged() {
+		unchanged++;
+	}
+	std::string stats() const;
+private:
+	// offset is 0 for an empty slot
+	struct Slot {
+		Fingerprint key;
+		uint64_t offset;
+	};
+	const char* parse(const char*, Page_state*) const;
+	std::unique_ptr<File_map> map;
+	std::vector<Slot> index;
+	size_t known = 0;
+	std::string file_name;
+	std::vector<char> buffer;
+	std::ofstream file;
+	std::mutex mutex;
+	std::atomic<size_t> unchanged{0};
+	size_t saved = 0;
+};
+
+// Compresses finished sitemap files to gzip on its own threads. Each file
+// is compressed by one thread, the queue is bounded to limit memory.
+class Gzip_pool {
+public:
+	~Gzip_pool();
+	void start(int);
+	void add(const std::string&, std::string&&);
+	void finish();
+	uint64_t get_in() const {
+		return in_bytes;
+	}
+	uint64_t get_out() const {
+		return out_bytes;
+	}
+private:
+	void run();
+	void compress(const std::string&, const std::string&);
+	std::vector<std::thread> threads;
+	std::deque<std::pair<std::string, std::string>> jobs;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable cond_space;
+	size_t limit = 0;
+	bool stop = false;
 	std::string error;
-	int cnt = 1;
+	std::atomic<uint64_t> in_bytes{0};
+	std::atomic<uint64_t> out_bytes{0};
+};
+
+// Writes the sitemap while crawling, an url is added as soon as it is
+// known to belong to the sitemap. Files are rotated by entry_lim and filemb_lim.
+// Entries are rendered by the calling thread and their exact size decides
+// the rotation, so files only depend on the order of entries.
+// With gzip a file is built in memory and compressed when it is rotated.
+class Sitemap_sink {
+public:
+	Sitemap_sink() : writer(file) {}
+	void open();
+	void add(const Url_struct*);
+	void add(const std::vector<const Url_struct*>&);
+	void close();
+	std::string stats() const;
+private:
+	void render(const Url_struct*, std::string&);
+	void write(const char*, size_t);
+	void open_file();
+	void close_file();
+	std::string file_name(int) const;
+	std::vector<char> buffer;
+	std::ofstream file;
+	std::string shard;
+	XML_writer writer;
+	Gzip_pool gzip;
+	std::mutex mutex;
+	std::string head;
+	std::string tail;
+	int file_cnt = 0;
+	int entry_cnt = 0;
+	uint64_t pos = 0;
+	std::atomic<size_t> entries{0};
+	friend class Bench;
+};
+
+// Writes the columns of info_db.h one after another, the head with
+// their offsets is written last.
+class Info_db_writer {
+public:
+	void open(const std::string&);
+	template<typename T, typename F> void column(info_db::column_t, size_t, F);
+	void strings(info_db::column_t, size_t, const std::function<Arena_str(size_t)>&);
+	void close(uint64_t, uint64_t, uint64_t);
+private:
+	void begin(info_db::column_t);
+	void end(info_db::column_t);
+	void put(const void* data, size_t size) {
+		file.write(static_cast<const char*>(data), size);
+		pos += size;
+	}
+	std::string file_name;
+	std::vector<char> buffer;
+	std::ofstream file;
+	info_db::Head head;
+	uint64_t pos = 0;
 };
 
-struct Filter {
-	int type;
-	int dir;
-	std::string val;
-	std::regex reg;
-	enum {type_regexp, type_get, type_ext};
-	enum {exclude, include, skip};
+// Base url of a page, parsed once and used to resolve every link found on it.
+class Url_base {
+public:
+	void set(const std::string&);
+	const std::string& str() const {
+		return href;
+	}
+	bool valid() const {
+		return ok;
+	}
+	const boost::url& url() const {
+		return parsed;
+	}
+	// resolved links are written here to reuse the buffer
+	boost::url scratch;
+private:
+	std::string href;
+	boost::url parsed;
+	bool ok = false;
+};
+
+// Checkpoint file: Checkpoint_head, records, string blob, string tables,
+// seen set slots. Sections are fixed size records and can be mapped as is.
+struct Checkpoint_head {
+	char magic[8];
+	uint64_t rec_cnt;
+	uint64_t blob_size;
+	uint64_t table_size;
+	uint64_t seen_size;
+};
+
+struct Checkpoint_rec {
+	uint64_t resolved_pos;
+	uint64_t found_pos;
+	uint32_t resolved_size;
+	uint32_t found_size;
+	uint32_t path_pos;
+	uint32_t path_len;
+	uint32_t host;
+	uint32_t charset;
+	uint32_t error;
+	int32_t parent;
+	int32_t try_cnt;
+	int32_t cnt;
+	int32_t duplicate;
+	uint8_t redirect_cnt;
+	uint8_t is_html;
+	uint8_t ssl;
+	uint8_t handle;
+	uint8_t done;
+	uint8_t reserved[7];
+	double time;
+	int64_t lastmod;
 };
 
 class Thread;
@@ -181,16 +893,25 @@ public:
 	void import_param(const std::string&);
 	void start();
 	void finished();
-	bool handle_url(Url_struct*, bool filter = true);
-	bool set_url(std::unique_ptr<Url_struct>&);
-	void try_again(Url_struct*);
+	bool handle_url(Url_new&, Url_base&, bool filter = true);
+	bool set_url(Url_new&, int worker = -1);
+	void try_again(Url_struct*, int, int delay = -1);
+	void release_url(Url_struct*);
 	bool get_url(Thread*);
+	bool poll_url(Thread*);
+	void wake(bool all = false);
+	void set_exception(std::exception_ptr);
 	std::string get_resolved(int);
-	std::string uri_normalize(const boost::url&);
+	static Fingerprint url_fingerprint(const boost::url&);
+	str_vec summary();
 	bool exit_handler();
+	void save_checkpoint();
+	void load_checkpoint();
+	void write_info_db();
 
 	// setting
 	std::string log_dir;
+	std::string info_db_file;
 	std::string sitemap_dir;
 	std::string param_url;
 	std::string xml_name = "sitemap";
@@ -207,32 +928,71 @@ public:
 	bool param_log_info = false;
 	bool param_subdomain = false;
 	int param_sleep = 0;
+	size_t param_host_limit = 0;
 	int thread_cnt = 1;
 	size_t redirect_limit = 5;
 	size_t url_limit = 0;
 	int xml_filemb_lim = 1;
 	int xml_entry_lim = 1000000;
+	bool xml_gzip = false;
+	int xml_gzip_threads = 0;
+	bool xml_lastmod = true;
 	int try_limit = 3;
+	int retry_delay = 1000;
+	int retry_max = 60000;
 	bool cert_verification = false;
 	std::string ca_cert_file_path;
 	std::string ca_cert_dir_path;
 	bool link_check = false;
 	bool sitemap = false;
-	std::vector<Filter> param_filter;
+	Filter param_filter;
 	int max_log_cnt = 100;
 	bool rewrite_log = false;
 	std::string param_interface;
+	bool keep_alive = true;
+	size_t pool_host_limit = 8;
+	int pool_idle_timeout = 30;
+	std::string engine = "thread";
+	size_t inflight = 2000;
+	bool stream_parse = true;
+	std::string seen_dir;
+	size_t seen_memory = 64;
+	size_t seen_expected = 100000000;
 	std::unordered_map<std::string, Xml_tag> param_xml_tag;
+	std::vector<std::regex> xml_tag_regex;
+	bool log_async = true;
+	size_t log_queue_size = 65536;
+	Log_queue::overflow_t log_overflow = Log_queue::block;
+	std::string recrawl_file;
+	bool compression = true;
+	bool content_dedup = false;
+	size_t dedup_memory = 16;
+	int dedup_distance = 3;
+	std::string checkpoint_file;
+	int checkpoint_interval = 300;
+	bool resume = false;
 
-	bool running = true;
+	std::atomic<bool> running{true};
+	std::atomic<bool> interrupted{false};
 	boost::urls::url uri;
+	std::string uri_host;
 	std::condition_variable cond;
+	std::mutex mutex_idle;
+	std::atomic<int> sleepers{0};
 	std::mutex mutex;
 	std::mutex mutex_log;
-	int thread_work = 0;
-	std::unordered_map<std::string, size_t> url_unique;
-	std::vector<std::unique_ptr<Url_struct>> url_all;
-	std::queue<Url_struct*> url_queue;
+	std::atomic<int> thread_work{0};
+	Seen_set url_unique;
+	Url_store url_all;
+	String_arena url_strings;
+	// strings of finished urls are still read
+	bool keep_strings = true;
+	String_table hosts;
+	String_table charsets;
+	String_table errors;
+	Frontier frontier;
+	Retry_queue retries;
+	Client_pool client_pool;
 	bool url_lim_reached = false;
 	LogWrap log_redirect_console;
 	LogWrap log_redirect_file;
@@ -249,37 +1009,235 @@ public:
 	LogWrap log_info_console;
 	LogWrap log_info_file;
 	LogWrap log_other;
-	std::ofstream sitemap_file;
+	Log_queue log_queue;
+	Sitemap_sink sitemap_sink;
+	Recrawl_store recrawl;
+	Content_index content_index;
+	Transfer_stats transfer;
+private:
+	void run_workers();
+	void checkpoint_loop();
+	std::thread checkpoint_thread;
+	std::mutex mutex_checkpoint;
+	std::condition_variable cond_checkpoint;
+	bool checkpoint_stop = false;
+};
+
+// Attributes of an open tag, from a parsed node or from the link scanner.
+// Values are returned with character references decoded.
+class Tag_attrs {
+public:
+	virtual ~Tag_attrs() {}
+	virtual std::string get(const std::string&) const = 0;
+};
+
+class Node_attrs: public Tag_attrs {
+public:
+	Node_attrs(html::node& n) : n(n) {}
+	std::string get(const std::string&) const;
+private:
+	html::node& n;
+};
+
+// Tag name and attributes read from the raw text of an open tag.
+// Names are lower case, the first of duplicates wins. A quote starts a value
+// only right after '=', elsewhere it is part of the name or value.
+class Scan_attrs: public Tag_attrs {
+public:
+	void parse(const char*, size_t);
+	std::string get(const std::string&) const;
+	const std::string& tag_name() const {
+		return name;
+	}
+private:
+	std::string name;
+	std::vector<std::pair<std::string, std::string>> attrs;
+	size_t cnt = 0;
+};
+
+// Splits an HTML stream into pieces that can be parsed on their own: a piece
+// never ends inside a tag, comment or script. Comment, script and style
+// contents are dropped since they hold no links.
+// In link mode only the raw text of open tags is passed on, nothing is kept.
+class Html_stream {
+public:
+	using Tag_callback = std::function<void(const char*, size_t)>;
+	void reset();
+	void feed(const char*, size_t, std::string&);
+	void feed(const char*, size_t, const Tag_callback&);
+	void finish(std::string&);
+	void finish(const Tag_callback&);
+private:
+	enum class state_t {text, tag, comment, rawtext};
+	void scan(const Tag_callback* on_tag = nullptr);
+	void drop(size_t);
+	static const size_t min_chunk = 16384;
+	std::string buf;
+	size_t pos = 0;
+	size_t safe = 0;
+	size_t tag_start = 0;
+	char quote = 0;
+	std::string raw_end;
+	state_t state = state_t::text;
 };
 
 class Thread {
 public:
+	// html page parsed while it downloads
+	struct Page {
+		Html_stream stream;
+		Url_base base;
+		bool active = false;
+		// previous and new state when recrawl is on, has_prev is set when
+		// the page is known; a flag rather than a pointer so moves keep it
+		bool has_prev = false;
+		Page_state prev_state;
+		Page_state state;
+		Hash128 hash;
+		Decoder decoder;
+		bool corrupt = false;
+		uint64_t wire = 0;
+		uint64_t body = 0;
+		// links found in this try
+		uint32_t links = 0;
+		void prepare(const Url_struct*);
+		httplib::Headers request_headers() const;
+		const Page_state* prev() const {
+			return has_prev ? &prev_state : nullptr;
+		}
+	};
 	Thread(int id) : id(id) {}
+	void init();
 	void start();
 	void join();
-	void set_url(std::unique_ptr<Url_struct>&);
+	void set_url(Url_new&);
+	int worker() const {
+		return id - 1;
+	}
 	bool suspend = false;
 	Url_struct* m_url = nullptr;
 private:
+	friend class Fetch_engine;
+	friend class Fetch_engine_test;
 	void load();
+	bool ssl_supported();
+	void request_finished(double);
+	bool http_headers(const httplib::Response&);
+	bool http_body(const char*, size_t);
+	void http_content(const char*, size_t);
+	bool decode_body(httplib::Response&);
 	void http_finished();
+	void html_found(const std::string&);
+	void parse_body(const std::string&);
+	void reuse_page();
+	bool duplicate(const Fingerprint&, const std::string&);
+	void page_done();
+	void handle_tag(const std::string&, const Tag_attrs&);
+	void error_reply(const std::string&);
 	int id;
+	Page page;
 	html::parser p;
+	bool scan_links = false;
+	Html_stream::Tag_callback on_tag;
+	Scan_attrs scan_attrs;
 	std::shared_ptr<httplib::Client> cli;
 	std::shared_ptr<httplib::Result> result;
+	long verify_result = 0;
+	bool retried = false;
+	std::unique_ptr<std::thread> uthread = nullptr;
+};
+
+#ifdef LINUX_PLATFORM
+// Non-blocking HTTP/1.1 client serving many requests from one epoll loop.
+// Completed responses are handed to Thread::http_finished().
+class Fetch_engine {
+public:
+	Fetch_engine(int, size_t);
+	~Fetch_engine();
+	void start();
+	void join();
+private:
+	using clock_ = std::chrono::steady_clock;
+	struct Conn;
+	void loop();
+	void begin(Url_struct*, bool reuse = true);
+	httplib::Error open(Conn*, bool);
+	bool resolve(const std::string&, int, sockaddr_storage&, socklen_t&);
+	bool bind_interface(int, int);
+	void handle(Conn*, uint32_t);
+	int io_read(Conn*, char*, size_t);
+	int io_write(Conn*, const char*, size_t);
+	bool consume(Conn*, const char*, size_t, httplib::Error&);
+	bool parse_head(Conn*, size_t);
+	bool feed_body(Conn*, const char*, size_t, httplib::Error&);
+	bool feed_chunked(Conn*, httplib::Error&);
+	void body_data(Conn*, const char*, size_t);
+	void set_events(Conn*, uint32_t);
+	void complete(Conn*);
+	void fail(Conn*, httplib::Error);
+	void done(Url_struct*, double, std::unique_ptr<httplib::Response>, httplib::Error, long, Thread::Page&& page = Thread::Page());
+	void close(Conn*);
+	void check_timeouts();
+	void abort_all();
+	Thread handler;
+	size_t inflight;
+	size_t active = 0;
+	int epfd = -1;
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	SSL_CTX* ssl_ctx = nullptr;
+#endif
+	std::unordered_map<Conn*, std::unique_ptr<Conn>> conns;
+	std::vector<std::unique_ptr<Conn>> closed;
+	std::unordered_map<std::string, std::vector<Conn*>> idle;
+	std::unordered_map<std::string, std::pair<sockaddr_storage, socklen_t>> dns;
+	clock_::time_point last_check = clock_::now();
 	std::unique_ptr<std::thread> uthread = nullptr;
+	friend class Fetch_engine_test;
 };
 
+struct Fetch_engine::Conn {
+	enum class state_t {connect, handshake, send, recv, idle};
+	enum class body_t {none, length, chunked, close};
+	int fd = -1;
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+	SSL* ssl = nullptr;
+#endif
+	std::string key;
+	std::string host;
+	state_t state = state_t::connect;
+	uint32_t events = 0;
+	Url_struct* url = nullptr;
+	bool head = false;
+	bool reused = false;
+	bool keep_alive = false;
+	bool read_any = false;
+	std::string out;
+	size_t out_pos = 0;
+	std::string in;
+	size_t in_pos = 0;
+	std::unique_ptr<httplib::Response> res;
+	bool head_done = false;
+	body_t body = body_t::none;
+	size_t body_left = 0;
+	bool chunk_data = false;
+	bool chunk_last = false;
+	long verify_result = 0;
+	Thread::Page page;
+	Timer timer;
+	clock_::time_point deadline;
+};
+#endif
+
 class Handler {
 public:
-	static bool attr_charset(html::node&, std::string&, Thread* t = nullptr);
-	static bool attr_refresh(html::node&, std::string&, Thread* t = nullptr);
-	static bool attr_srcset(html::node&, std::string&, Thread* t = nullptr);
+	static bool attr_charset(const Tag_attrs&, std::string&, Thread* t = nullptr);
+	static bool attr_refresh(const Tag_attrs&, std::string&, Thread* t = nullptr);
+	static bool attr_srcset(const Tag_attrs&, std::string&, Thread* t = nullptr);
 };
 
 struct Attr {
 	std::string name;
-	std::function<bool(html::node&, std::string&, Thread*)> pre;
+	std::function<bool(const Tag_attrs&, std::string&, Thread*)> pre;
 };
 
 struct Tag {
@@ -287,6 +1245,32 @@ struct Tag {
 	std::vector<Attr> attr;
 };
 
+// Tag name lookup for the parser callback. A perfect hash over the names of
+// Tags_main and Tags_other is searched at startup, a lookup is one hash and one compare.
+class Tag_table {
+public:
+	struct Entry {
+		std::string name;
+		bool main = false;
+		const Tag* other = nullptr;
+	};
+	Tag_table(const std::vector<std::string>&, const std::vector<Tag>&);
+	const Entry* find(const std::string&) const;
+private:
+	static uint64_t hash(const std::string&, uint64_t);
+	std::vector<Entry> entries;
+	std::vector<int> slots;
+	uint64_t seed = 0;
+	size_t mask = 0;
+};
+
+extern std::vector<std::string> Tags_main;
+extern std::vector<Tag> Tags_other;
+extern Tag_table tag_table;
+
+extern Main main_obj;
+extern std::exception_ptr exc_ptr;
+
 namespace sys {
 
 bool handle_exit();
@@ -295,7 +1279,16 @@ bool handle_exit();
 
 namespace utils {
 
+const size_t file_buffer_size = 1 << 20;
+
 bool file_exists(const std::string&);
+Fingerprint hash128(const char*, size_t);
+const char* find_xml_special(const char*, const char*);
+const char* find_tag_end(const char*, const char*);
+std::string decode_refs(const std::string&);
+bool parse_http_date(const std::string&, int64_t&);
+int retry_after(const std::string&);
+std::string w3c_date(int64_t);
 
 }
 
@@ -0,0 +1,189 @@
+// Exports the binary info table written with log.info_db to csv.
+// Usage: sitemap_db <file> [separator]
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "info_db.h"
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only view of the whole file, mapped where mmap is available.
+class Db_file {
+public:
+	explicit Db_file(const std::string&);
+	~Db_file();
+	const char* data() const {
+		return ptr;
+	}
+	uint64_t size() const {
+		return len;
+	}
+private:
+	const char* ptr = nullptr;
+	uint64_t len = 0;
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+	std::vector<char> content;
+#endif
+};
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+Db_file::Db_file(const std::string& name) {
+	std::ifstream file(name, std::ifstream::binary);
+	if(!file.is_open()) {
+		throw std::runtime_error("Can not open " + name);
+	}
+	content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	ptr = content.data();
+	len = content.size();
+}
+
+Db_file::~Db_file() {}
+#else
+Db_file::Db_file(const std::string& name) {
+	int fd = ::open(name.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw std::runtime_error("Can not open " + name);
+	}
+	struct stat st;
+	if(fstat(fd, &st) || !st.st_size) {
+		::close(fd);
+		throw std::runtime_error("Can not read " + name);
+	}
+	void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED) {
+		throw std::runtime_error("Can not map " + name);
+	}
+	ptr = static_cast<const char*>(p);
+	len = st.st_size;
+}
+
+Db_file::~Db_file() {
+	munmap(const_cast<char*>(ptr), len);
+}
+#endif
+
+class Db_reader {
+public:
+	Db_reader(const char*, uint64_t);
+	uint64_t rows() const {
+		return head.rows;
+	}
+	template<typename T> T value(info_db::column_t, uint64_t) const;
+	std::string str(info_db::column_t, uint64_t) const;
+	std::string charset(uint64_t) const;
+	std::string msg(uint64_t) const;
+private:
+	const char* data;
+	info_db::Head head;
+};
+
+Db_reader::Db_reader(const char* _data, uint64_t size) : data(_data) {
+	if(!info_db::check(data, size)) {
+		throw std::runtime_error("Not a valid info table");
+	}
+	std::memcpy(&head, data, sizeof(head));
+}
+
+template<typename T>
+T Db_reader::value(info_db::column_t c, uint64_t row) const {
+	T ret;
+	std::memcpy(&ret, data + head.columns[c].offset + row * sizeof(T), sizeof(T));
+	return ret;
+}
+
+// String of a row from an offsets column and the heap that follows it.
+std::string Db_reader::str(info_db::column_t c, uint64_t row) const {
+	auto begin = value<uint64_t>(c, row);
+	auto end = value<uint64_t>(c, row + 1);
+	const auto& heap = head.columns[c + 1];
+	if(begin > end || end > heap.size) {
+		throw std::runtime_error("Not a valid info table");
+	}
+	return std::string(data + heap.offset + begin, end - begin);
+}
+
+std::string Db_reader::charset(uint64_t row) const {
+	auto id = value<uint32_t>(info_db::charset, row);
+	return id < head.charset_cnt ? str(info_db::charset_offset, id) : std::string();
+}
+
+std::string Db_reader::msg(uint64_t row) const {
+	auto id = value<uint32_t>(info_db::msg, row);
+	return id < head.msg_cnt ? str(info_db::msg_offset, id) : std::string();
+}
+
+// Quoted like the csv logs of sitemap, quotes are doubled.
+static void write_field(std::string& out, const std::string& str, const std::string& separator) {
+	if(str.find('"') == std::string::npos && str.find(separator) == std::string::npos) {
+		out += str;
+		return;
+	}
+	out += '"';
+	for(char c : str) {
+		out += c;
+		if(c == '"') {
+			out += '"';
+		}
+	}
+	out += '"';
+}
+
+int main(int argc, char* argv[]) {
+	if(argc < 2 || argc > 3) {
+		std::cerr << "Usage: sitemap_db <file> [separator]" << std::endl;
+		return 1;
+	}
+	std::string separator(argc == 3 ? argv[2] : ",");
+	try {
+		Db_file file(argv[1]);
+		Db_reader db(file.data(), file.size());
+		const char* names[] = {"id", "parent", "time", "try_cnt", "cnt", "is_html", "found", "url", "charset", "msg", "duplicate"};
+		std::string out;
+		for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+			out += i ? separator + names[i] : names[i];
+		}
+		out += '\n';
+		char num[64];
+		for(uint64_t row = 0; row < db.rows(); row++) {
+			out += std::to_string(db.value<int32_t>(info_db::id, row)) + separator;
+			out += std::to_string(db.value<int32_t>(info_db::parent, row)) + separator;
+			std::snprintf(num, sizeof(num), "%f", db.value<double>(info_db::time, row));
+			out += num + separator;
+			out += std::to_string(db.value<int32_t>(info_db::try_cnt, row)) + separator;
+			out += std::to_string(db.value<int32_t>(info_db::cnt, row)) + separator;
+			out += std::to_string(db.value<uint8_t>(info_db::is_html, row)) + separator;
+			write_field(out, db.str(info_db::found_offset, row), separator);
+			out += separator;
+			write_field(out, db.str(info_db::url_offset, row), separator);
+			out += separator;
+			write_field(out, db.charset(row), separator);
+			out += separator;
+			write_field(out, db.msg(row), separator);
+			out += separator + std::to_string(db.value<int32_t>(info_db::duplicate, row)) + '\n';
+			if(out.size() > (1 << 20)) {
+				std::cout.write(out.data(), out.size());
+				out.clear();
+			}
+		}
+		std::cout.write(out.data(), out.size());
+		std::cout.flush();
+	} catch(std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
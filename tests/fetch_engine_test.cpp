@@ -0,0 +1,180 @@
+// Feeds raw HTTP/1.1 responses to Fetch_engine::consume split at every
+// position and checks the parsed status, body and framing. A 304 of a page
+// known from the previous run is passed through complete to the handler.
+
+#include "sitemap.h"
+
+#ifdef LINUX_PLATFORM
+
+class Fetch_engine_test {
+public:
+	Fetch_engine_test() : engine(1, 1) {}
+	int run();
+private:
+	struct Expect {
+		int status;
+		std::string body;
+		bool complete;
+		bool keep_alive;
+	};
+	bool check(const std::string&, const std::string&, const Expect&, bool head = false);
+	bool feed(const std::vector<std::string>&, bool, Expect&, bool&);
+	bool not_modified();
+	Fetch_engine engine;
+	Url_struct url;
+};
+
+// Feeds the pieces in order, false on a framing error.
+bool Fetch_engine_test::feed(const std::vector<std::string>& pieces, bool head, Expect& got, bool& extra) {
+	Fetch_engine::Conn c;
+	c.url = &url;
+	c.head = head;
+	c.res.reset(new httplib::Response);
+	got.complete = false;
+	extra = false;
+	for(const auto& piece : pieces) {
+		if(got.complete) {
+			// no bytes may follow the end of a response
+			extra = extra || !piece.empty();
+			continue;
+		}
+		httplib::Error err = httplib::Error::Success;
+		got.complete = engine.consume(&c, piece.data(), piece.size(), err);
+		if(err != httplib::Error::Success) {
+			return false;
+		}
+	}
+	got.status = c.res->status;
+	got.body = c.res->body;
+	got.keep_alive = c.keep_alive;
+	return true;
+}
+
+// The response is fed whole, split in two at every position and byte by byte.
+bool Fetch_engine_test::check(const std::string& name, const std::string& raw, const Expect& expect, bool head) {
+	std::vector<std::vector<std::string>> cases;
+	cases.push_back({raw});
+	for(size_t i = 1; i < raw.size(); i++) {
+		cases.push_back({raw.substr(0, i), raw.substr(i)});
+	}
+	std::vector<std::string> bytes;
+	for(char ch : raw) {
+		bytes.push_back(std::string(1, ch));
+	}
+	cases.push_back(bytes);
+	for(size_t i = 0; i < cases.size(); i++) {
+		Expect got;
+		bool extra;
+		if(!feed(cases[i], head, got, extra)) {
+			std::cout << name << ": framing error in case " << i << std::endl;
+			return false;
+		}
+		if(extra || got.status != expect.status || got.body != expect.body || got.complete != expect.complete || got.keep_alive != expect.keep_alive) {
+			std::cout << name << ": case " << i << " status " << got.status << " complete " << got.complete << " keep_alive " << got.keep_alive << " body '" << got.body << "'" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// The page state moves from the connection to the handler, the previous
+// state must come with it: charset, hash and validators are kept.
+bool Fetch_engine_test::not_modified() {
+	const std::string resolved = "http://www.sitename.xx/page.html";
+	Url_struct page_url;
+	page_url.resolved.data = resolved.data();
+	page_url.resolved.size = static_cast<uint32_t>(resolved.size());
+	page_url.handle = url_handle_t::query_parse;
+	std::unique_ptr<Fetch_engine::Conn> conn(new Fetch_engine::Conn);
+	auto c = conn.get();
+	engine.conns[c] = std::move(conn);
+	c->url = &page_url;
+	c->page.has_prev = true;
+	c->page.prev_state.etag = "\"v1\"";
+	c->page.prev_state.last_modified = "Sat, 17 Oct 2026 10:00:00 GMT";
+	c->page.prev_state.charset = "windows-1251";
+	c->page.prev_state.hash = utils::hash128("body", 4);
+	c->res.reset(new httplib::Response);
+	const std::string raw = "HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n";
+	httplib::Error err = httplib::Error::Success;
+	if(!engine.consume(c, raw.data(), raw.size(), err)) {
+		std::cout << "not modified: response not complete" << std::endl;
+		return false;
+	}
+	engine.active++;
+	engine.complete(c);
+	const auto& page = engine.handler.page;
+	if(!page.prev() || page.prev()->etag != "\"v1\"") {
+		std::cout << "not modified: previous state lost" << std::endl;
+		return false;
+	}
+	if(page.state.etag != "\"v1\"" || page.state.last_modified != "Sat, 17 Oct 2026 10:00:00 GMT" || !(page.state.hash == page.prev()->hash)) {
+		std::cout << "not modified: validators '" << page.state.etag << "' '" << page.state.last_modified << "'" << std::endl;
+		return false;
+	}
+	if(main_obj.charsets.get(page_url.charset) != "windows-1251" || !page_url.is_html || !page_url.done) {
+		std::cout << "not modified: page not reused" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int Fetch_engine_test::run() {
+	url.handle = url_handle_t::query;
+	int failed = 0;
+	failed += !check("content-length",
+		"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 11\r\n\r\nhello world",
+		{200, "hello world", true, true});
+	failed += !check("content-length close",
+		"HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 3\r\n\r\nabc",
+		{200, "abc", true, false});
+	failed += !check("chunked",
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n1;ext=1\r\n \r\n5\r\nworld\r\n0\r\n\r\n",
+		{200, "hello world", true, true});
+	failed += !check("chunked trailers",
+		"HTTP/1.1 200 OK\r\nTransfer-Encoding: Chunked\r\n\r\na\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\n",
+		{200, "0123456789", true, true});
+	failed += !check("close delimited",
+		"HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n<p>body</p>",
+		{200, "<p>body</p>", false, false});
+	failed += !check("interim response",
+		"HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 404 Not Found\r\nContent-Length: 4\r\n\r\nnone",
+		{404, "none", true, true});
+	failed += !check("no body",
+		"HTTP/1.1 304 Not Modified\r\nETag: \"x\"\r\n\r\n",
+		{304, "", true, true});
+	failed += !check("head",
+		"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n",
+		{200, "", true, true}, true);
+	failed += !check("empty length",
+		"HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n",
+		{200, "", true, true});
+	// a chunk size line that is not hex is a framing error
+	Expect got;
+	bool extra;
+	if(feed({"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n"}, false, got, extra)) {
+		std::cout << "bad chunk size: accepted" << std::endl;
+		failed++;
+	}
+	if(feed({"garbage\r\n\r\n"}, false, got, extra)) {
+		std::cout << "bad status line: accepted" << std::endl;
+		failed++;
+	}
+	failed += !not_modified();
+	return failed;
+}
+
+int main() {
+	Fetch_engine_test test;
+	int failed = test.run();
+	std::cout << (failed ? "FAILED" : "OK") << std::endl;
+	return failed ? 1 : 0;
+}
+
+#else
+
+int main() {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,119 @@
+// Runs the link scanner (Html_stream and Scan_attrs) and the html parser over
+// the pages given as arguments and compares the links both find. The parser
+// gets the whole page and the pieces of Html_stream like in the crawler.
+
+#include "sitemap.h"
+
+using Link = std::pair<url_handle_t, std::string>;
+using Links = std::vector<Link>;
+
+// Same tag and attribute selection as Thread::handle_tag, with link checks
+// on. Values of attributes that have a handler are compared as found.
+static void collect(const std::string& tag_name, const Tag_attrs& attrs, Links& links) {
+	if(tag_name == "base") {
+		links.emplace_back(url_handle_t::none, attrs.get("href"));
+		return;
+	}
+	auto entry = tag_table.find(tag_name);
+	if(!entry) {
+		return;
+	}
+	if(entry->main) {
+		auto href = attrs.get("href");
+		if(!href.empty()) {
+			links.emplace_back(url_handle_t::query_parse, href);
+		}
+		return;
+	}
+	for(auto& attr : entry->other->attr) {
+		auto href = attrs.get(attr.name);
+		if(!href.empty()) {
+			links.emplace_back(url_handle_t::query, href);
+		}
+	}
+}
+
+static Links scan(const std::string& page, size_t chunk) {
+	Links links;
+	Html_stream stream;
+	Scan_attrs attrs;
+	Html_stream::Tag_callback on_tag = [&](const char* data, size_t size) {
+		attrs.parse(data, size);
+		collect(attrs.tag_name(), attrs, links);
+	};
+	for(size_t i = 0; i < page.size(); i += chunk) {
+		stream.feed(page.data() + i, std::min(chunk, page.size() - i), on_tag);
+	}
+	stream.finish(on_tag);
+	return links;
+}
+
+static Links parse(const std::string& page, size_t chunk) {
+	Links links;
+	html::parser p;
+	p.set_callback([&](html::node& n) {
+		if(n.type_node == html::node_t::tag && n.type_tag == html::tag_t::open) {
+			collect(n.tag_name, Node_attrs(n), links);
+		}
+	});
+	if(!chunk) {
+		p.parse(page);
+		return links;
+	}
+	Html_stream stream;
+	std::string piece;
+	for(size_t i = 0; i < page.size(); i += chunk) {
+		stream.feed(page.data() + i, std::min(chunk, page.size() - i), piece);
+		if(!piece.empty()) {
+			p.parse(piece);
+			piece.clear();
+		}
+	}
+	stream.finish(piece);
+	if(!piece.empty()) {
+		p.parse(piece);
+	}
+	return links;
+}
+
+static void print(const char* name, const Links& links) {
+	const char* handles[] = {"query", "query_parse", "none"};
+	std::cout << "  " << name << ":" << std::endl;
+	for(const auto& link : links) {
+		std::cout << "    " << handles[static_cast<int>(link.first)] << " " << link.second << std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int failed = 0;
+	for(int i = 1; i < argc; i++) {
+		std::ifstream file(argv[i], std::ifstream::binary);
+		if(!file.is_open()) {
+			std::cout << "Can not open " << argv[i] << std::endl;
+			failed++;
+			continue;
+		}
+		std::string page((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		auto expect = parse(page, 0);
+		if(expect.empty()) {
+			std::cout << argv[i] << ": no links" << std::endl;
+			failed++;
+			continue;
+		}
+		// whole, in small pieces and byte by byte
+		for(size_t chunk : {page.size(), static_cast<size_t>(7), static_cast<size_t>(1)}) {
+			auto scanned = scan(page, chunk);
+			auto streamed = parse(page, chunk);
+			if(scanned != expect || streamed != expect) {
+				std::cout << argv[i] << ": links differ, chunk " << chunk << std::endl;
+				print("parser", expect);
+				print("scanner", scanned);
+				print("parser with stream", streamed);
+				failed++;
+				break;
+			}
+		}
+	}
+	std::cout << (failed ? "FAILED" : "OK") << std::endl;
+	return failed ? 1 : 0;
+}